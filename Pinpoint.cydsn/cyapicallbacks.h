@@ -4,5 +4,6 @@
 #define GPS_RXISR_EXIT_CALLBACK
 #define PC_RXISR_EXIT_CALLBACK
 #define XB_RXISR_EXIT_CALLBACK
+#define XB_TXISR_EXIT_CALLBACK
     
 #endif
@@ -1,5 +1,6 @@
 #include "display.h"
 #include <project.h>
+#include "tick.h"
 
 /*
     Turns all functions of the display on, runs through the touch-screen
@@ -7,7 +8,6 @@
 */
 void Disp_FurtherInit(Self *me, uint16 *calX, uint16 *calY) {
     int i;
-    GPS_Rate = 1;
     XB_Rate = 0;
     
     if (!Adafruit_RA8875_begin()) {
@@ -127,12 +127,11 @@ void Disp_touchResponse(int x, int y) {
             }
             else if (x >= 370 && x < 420) {
                 PC_PutString("GPS rate\r\n");
-                if (BUTTON_HIT(x, y, 370, 5))
-                    GPS_Rate = 0;
-                else if (BUTTON_HIT(x, y, 370, 165))
-                    GPS_Rate = 1;
-                else if (BUTTON_HIT(x, y, 370, 325))
-                    GPS_Rate = 2;
+                for (listInd = 0; listInd < GPS_NUM_RATES; listInd++) {
+                    // Reprograms the receiver in the background
+                    if (GPS_BUTTON_HIT(x, y, listInd))
+                        GPS_SetRate(listInd);
+                }
                 drawSettingsButtons();
             }
             else if (x >= 520 && x < 570) {
@@ -148,7 +147,7 @@ void Disp_touchResponse(int x, int y) {
             break;
         case MENU_MESSAGES:
             listInd = (LIST_POS(x, 100, 50, 13));
-            if (listInd >= 0 && (u = findUserAtPos(myself->users, listInd))) {
+            if (listInd >= 0 && (u = findUserAtPos(&myself->users, listInd))) {
                 goToMenu(MENU_CONVERSATION, u);
             }
             break;
@@ -158,7 +157,7 @@ void Disp_touchResponse(int x, int y) {
                 if (listInd == 0) {
                     goToMenu(MENU_INFO_DETAILS, myself);
                 }
-                else if ((u = findUserAtPos(myself->users, --listInd))){
+                else if ((u = findUserAtPos(&myself->users, --listInd))){
                     goToMenu(MENU_INFO_DETAILS, u);
                 }
             }
@@ -189,20 +188,35 @@ void Disp_touchResponse(int x, int y) {
     }
 }
 
+/*
+    Redraws whatever is showing the users, after some were added,
+    dropped or went stale. List positions shift when a user is dropped.
+*/
+void Disp_Refresh_Users() {
+    if (curMenu == MENU_HOME)
+        Disp_Refresh_Map();
+    else if (curMenu == MENU_MESSAGES || curMenu == MENU_INFO)
+        goToMenu(curMenu, NULL);
+}
+
 /*
     Updates the map to show any changes in User positions.
     If there are no users, it prints an empty map with default
     max distance of 2.0 miles.
 */
 void Disp_Refresh_Map() {
-     // If you have more than 30 users, fix this
-    float latDist[30], lonDist[30], totDist;
+    int32 latDist[MAX_USERS], lonDist[MAX_USERS];
+    uint32 totDist;
     int i, numInvalid = 0;
-    float maxDist = 3.0/8; // So that the default is 0.5 miles
-    double transX, transY;
+    uint32 maxDist = 604; // Meters, so that the default is 0.5 miles
+    int32 transX, transY;
     char text[100];
-    User *u = myself->users;
-    Position *my_pos = (Position*)&(myself->rmc.lat);
+    User *u;
+    NAV_Solution nav;
+    Position *my_pos = (Position*)&nav.lat;
+    Position p;
+    
+    readNav(&myself->nav, &nav);
     
     /* Switch to graphics mode and print the map */
     Adafruit_RA8875_graphicsMode(); CyDelay(20);
@@ -216,17 +230,19 @@ void Disp_Refresh_Map() {
     Adafruit_RA8875_drawCircle(500, 240, 80, RA8875_WHITE);
     Adafruit_RA8875_fillCircle(500, 240, 7, RA8875_WHITE);
     
-    // Find all the distances
-    for (i = 0; u; i++, u = u->next) {
+    // Find all the distances, to where users are estimated to be by now
+    for (i = 0; i < myself->users.count; i++) {
+        u = myself->users.list[i];
+        predictUser(u, msTicks, &p);
         // Only calculate if ours and the user's positions are valid
-        if (u->pos.latDir && my_pos->latDir) {
-            totDist = distance(my_pos->lat, my_pos->lon, u->pos.lat, u->pos.lon, latDist + i, lonDist + i);
+        if (p.latDir && my_pos->latDir) {
+            totDist = distance(my_pos->lat, my_pos->lon, p.lat, p.lon, latDist + i, lonDist + i);
             if (totDist > maxDist)
                 maxDist = totDist;
         }
     }
     
-    maxDist *= 4.0 / 3;
+    maxDist = maxDist * 4 / 3;
     
     // Print the ring labels
     Adafruit_RA8875_textMode(); CyDelay(20);
@@ -234,18 +250,18 @@ void Disp_Refresh_Map() {
     Adafruit_RA8875_textColor(RA8875_WHITE, RA8875_BLACK);
     
     Adafruit_RA8875_textSetCursor(730, 210);
-    sprintf(text, "%0.1f mi", maxDist);
+    milesString(text, maxDist, 1, "mi");
     Adafruit_RA8875_textWrite(text, strlen(text));
     
     Adafruit_RA8875_textSetCursor(650, 210);
-    sprintf(text, "%0.1f mi", maxDist * 2 / 3);
+    milesString(text, maxDist * 2 / 3, 1, "mi");
     Adafruit_RA8875_textWrite(text, strlen(text));
     
     Adafruit_RA8875_textSetCursor(570, 210);
-    sprintf(text, "%0.1f mi", maxDist / 3);
+    milesString(text, maxDist / 3, 1, "mi");
     Adafruit_RA8875_textWrite(text, strlen(text));
     
-    if (!myself->users) {
+    if (!myself->users.count) {
         Adafruit_RA8875_textEnlarge(0);
         Adafruit_RA8875_textColor(RA8875_RED, RA8875_BLACK);
         Adafruit_RA8875_textSetCursor(240, 160);
@@ -260,11 +276,13 @@ void Disp_Refresh_Map() {
     
     Adafruit_RA8875_graphicsMode(); CyDelay(20);
     // Paint all the users
-    for (u = myself->users, i = 0; u; i++, u = u->next) {
+    for (i = 0; i < myself->users.count; i++) {
+        u = myself->users.list[i];
         if (u->pos.latDir != 0 && my_pos->latDir) {
-            transX = 240 * latDist[i] / maxDist;
-            transY = 240 * lonDist[i] / maxDist;
-            Adafruit_RA8875_fillCircle(500 + transX, 240 - transY, 7, u->uniqueID & RA8875_WHITE);
+            transX = (int64)240 * latDist[i] / (int32)maxDist;
+            transY = (int64)240 * lonDist[i] / (int32)maxDist;
+            Adafruit_RA8875_fillCircle(500 + transX, 240 - transY, 7,
+             u->stale ? RA8875_GRAY : u->uniqueID & RA8875_WHITE);
         }
         else
             ++numInvalid;
@@ -287,11 +305,11 @@ void Disp_Refresh_Map() {
     to 1;
 */
 void Disp_Update_Time(int force) {
-    int utc = myself->rmc.utc;
+    uint32 utc = viewNav(&myself->nav)->utc;
     static int prevMin = -1;
     char text[13];
-    int hours = utc / 10000;
-    int minutes = (utc % 10000) / 100;
+    int hours = utc / 3600000;
+    int minutes = (utc / 60000) % 60;
     char *meridiem;
     char *format;
     
@@ -329,7 +347,7 @@ void Disp_Update_Time(int force) {
     <x> and <y> are the screen coordinates for the touch.
 */
 void updateMessage(int x, int y) {
-    Message *m = &curConvo->tempMsg;
+    Draft *m = &myself->draft;
     static int cap = 0;
     int key = -1;
     const char keys[] = {'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p',
@@ -446,6 +464,31 @@ void updateNameEdit(int x, int y) {
     }
 }
 
+/*
+    Prints <meters> as miles with 1 or 2 decimals and <unit> into <str>,
+    e.g. "0.5 mi" or "0.52 miles". Integer math only.
+*/
+void milesString(char *str, uint32 meters, int decimals, const char *unit) {
+    uint32 scale = decimals == 1 ? 10 : 100;
+    uint32 miles = (meters * scale + 805) / 1609;
+    
+    sprintf(str, decimals == 1 ? "%lu.%01lu %s" : "%lu.%02lu %s",
+     miles / scale, miles % scale, unit);
+}
+
+/*
+    Prints a coordinate pair in 1e-7 degrees as decimal
+    degrees with 4 decimals into <str>.
+*/
+void coordString(char *str, int32 lat, int32 lon) {
+    uint32 absLat = lat < 0 ? -lat : lat;
+    uint32 absLon = lon < 0 ? -lon : lon;
+    
+    sprintf(str, "%s%lu.%04lu, %s%lu.%04lu",
+     lat < 0 ? "-" : "", absLat / NMEA_DEG_SCALE, (absLat % NMEA_DEG_SCALE) / 1000,
+     lon < 0 ? "-" : "", absLon / NMEA_DEG_SCALE, (absLon % NMEA_DEG_SCALE) / 1000);
+}
+
 /*
     Draws the Home screen
 */
@@ -518,29 +561,30 @@ void drawKeyboard() {
 }
 
 void drawSettingsButtons() {
+    int i;
+    
     // Print all the buttons
     Adafruit_RA8875_graphicsMode(); CyDelay(20);
-    Adafruit_RA8875_fillRoundRect(370,   5, 50, 150, 5, RA8875_GRAY);
-    Adafruit_RA8875_fillRoundRect(370, 165, 50, 150, 5, RA8875_GRAY);
-    Adafruit_RA8875_fillRoundRect(370, 325, 50, 150, 5, RA8875_GRAY);
+    for (i = 0; i < GPS_NUM_RATES; i++)
+        Adafruit_RA8875_fillRoundRect(370, GPS_BUTTON_Y(i), 50, 90, 5, RA8875_GRAY);
     Adafruit_RA8875_fillRoundRect(520,   5, 50, 150, 5, RA8875_GRAY);
     Adafruit_RA8875_fillRoundRect(520, 165, 50, 150, 5, RA8875_GRAY);
     Adafruit_RA8875_fillRoundRect(520, 325, 50, 150, 5, RA8875_GRAY);
     
     // Print the active buttons
-    Adafruit_RA8875_fillRoundRect(370, 5 + (GPS_Rate * 160), 50, 150, 5, RA8875_BLUE);
+    Adafruit_RA8875_fillRoundRect(370, GPS_BUTTON_Y(gpsRate), 50, 90, 5, RA8875_BLUE);
     Adafruit_RA8875_fillRoundRect(520, 5 + (XB_Rate * 160),  50, 150, 5, RA8875_BLUE);
     
     // Print the labels
     Adafruit_RA8875_textMode(); CyDelay(20);
     Adafruit_RA8875_textEnlarge(1);
     Adafruit_RA8875_textTransparent(RA8875_WHITE);
-    Adafruit_RA8875_textSetCursor(377, 30);
-    Adafruit_RA8875_textWrite("1/3 Hz", 6);
-    Adafruit_RA8875_textSetCursor(377, 190);
-    Adafruit_RA8875_textWrite("1/2 Hz", 6);
-    Adafruit_RA8875_textSetCursor(377, 368);
-    Adafruit_RA8875_textWrite("1 Hz", 4);
+    for (i = 0; i < GPS_NUM_RATES; i++) {
+        // Centered, characters are 16 pixels wide
+        int len = strlen(gpsRates[i].label);
+        Adafruit_RA8875_textSetCursor(377, GPS_BUTTON_Y(i) + (90 - 16 * len) / 2);
+        Adafruit_RA8875_textWrite(gpsRates[i].label, len);
+    }
     Adafruit_RA8875_textSetCursor(527, 30);
     Adafruit_RA8875_textWrite("1/3 Hz", 6);
     Adafruit_RA8875_textSetCursor(527, 190);
@@ -585,7 +629,7 @@ void drawSettings(){
 }
 
 void drawMessages(){
-    int x;
+    int x, i;
     User *u;
     char str[50];
     
@@ -602,10 +646,12 @@ void drawMessages(){
     Adafruit_RA8875_textWrite("Messages", 8);
     
     /* Print the list */
-    // Will break for more than 13 users ***
+    // Only room for the first 13 users ***
     Adafruit_RA8875_textTransparent(RA8875_WHITE);
     x = 100;
-    for (u = myself->users; u; u = u->next) {
+    for (i = 0; i < myself->users.count && i < 13; i++) {
+        u = myself->users.list[i];
+        Adafruit_RA8875_textTransparent(u->stale ? RA8875_GRAY : RA8875_WHITE);
         Adafruit_RA8875_textSetCursor(x, 10);
         sprintf(str, "%s(%d)", u->name, u->numMsgs);
         Adafruit_RA8875_textWrite(str, strlen(str));
@@ -621,7 +667,7 @@ void drawMessages(){
 
 void drawInfo(){
     User *u;
-    int x = 150;
+    int x = 150, i;
     /* Print the buttons */
     Adafruit_RA8875_graphicsMode(); CyDelay(20);
     Adafruit_RA8875_fillScreen(RA8875_BLACK);
@@ -635,11 +681,13 @@ void drawInfo(){
     Adafruit_RA8875_textWrite("Information", 11);
     
     /* Print the list */
-    // Will break for more than 13 users ***
+    // Only room for the first 12 users ***
     Adafruit_RA8875_textTransparent(RA8875_WHITE);
     Adafruit_RA8875_textSetCursor(100, 10);
     Adafruit_RA8875_textWrite("You", 3);
-    for (u = myself->users; u; u = u->next) {
+    for (i = 0; i < myself->users.count && i < 12; i++) {
+        u = myself->users.list[i];
+        Adafruit_RA8875_textTransparent(u->stale ? RA8875_GRAY : RA8875_WHITE);
         Adafruit_RA8875_textSetCursor(x, 10);
         Adafruit_RA8875_textWrite(u->name, strlen(u->name));
         x += 50;
@@ -675,7 +723,8 @@ void drawNameEdit(){
 }
 
 void drawConvo(User *user){
-    Message *m = user->msgs;
+    MsgIter it = {0};
+    MsgRecord *m;
     int x = 100;
     
     curConvo = user;
@@ -697,34 +746,29 @@ void drawConvo(User *user){
     Adafruit_RA8875_textTransparent(RA8875_WHITE);
     Adafruit_RA8875_textEnlarge(1);
     int lines = 0;
-    if (m) {
-        // Count the messages we can display
-        do {
-            m = m->prev;
-            int tempLines = m->msgLen / CHAR_PER_LINE + 1;
-            if (tempLines + lines > MAX_LINES) {
-                m = m->next;
-                break;
-            }
-            lines += tempLines;
-        } while(m != user->msgs);
+    // Count the lines of all the messages
+    while ((m = nextMessage(user, &it)))
+        lines += m->len / CHAR_PER_LINE + 1;
+    
+    // Display the newest messages that fit
+    memset(&it, 0, sizeof(it));
+    while ((m = nextMessage(user, &it))) {
+        if (lines > MAX_LINES) {
+            lines -= m->len / CHAR_PER_LINE + 1;
+            continue;
+        }
+        if (m->sent)
+            Adafruit_RA8875_textColor(RA8875_WHITE, RA8875_GREEN);
+        else
+            Adafruit_RA8875_textColor(RA8875_WHITE, RA8875_BLUE);
         
-        // Display the messages.
-        do {
-            if (m->sent)
-                Adafruit_RA8875_textColor(RA8875_WHITE, RA8875_GREEN);
-            else
-                Adafruit_RA8875_textColor(RA8875_WHITE, RA8875_BLUE);
-            
-            Adafruit_RA8875_textSetCursor(x, 0);
-            if (m->msgLen)
-                Adafruit_RA8875_textWrite(m->msg, m->msgLen);
-            else
-                Adafruit_RA8875_textWrite(" ", 1);
-            
-            x += (int)(m->msgLen / CHAR_PER_LINE + 1) * PIX_PER_LINE;
-            m = m->next;
-        } while(m != user->msgs);
+        Adafruit_RA8875_textSetCursor(x, 0);
+        if (m->len)
+            Adafruit_RA8875_textWrite(m->text, m->len);
+        else
+            Adafruit_RA8875_textWrite(" ", 1);
+        
+        x += (int)(m->len / CHAR_PER_LINE + 1) * PIX_PER_LINE;
     }
     
     /* Print the button labels */
@@ -747,12 +791,17 @@ void drawCompose(){
     
     drawKeyboard();
     
-    /* Print the temp message */
-    if (curConvo->tempMsg.msgLen) {
+    /* Print the draft, unless it was for someone else */
+    if (myself->draft.to != curConvo->uniqueID) {
+        myself->draft.to = curConvo->uniqueID;
+        myself->draft.msgLen = 0;
+        myself->draft.msg[0] = 0;
+    }
+    if (myself->draft.msgLen) {
         Adafruit_RA8875_textEnlarge(2);
         Adafruit_RA8875_textTransparent(RA8875_WHITE);
         Adafruit_RA8875_textSetCursor(0, 0);
-        Adafruit_RA8875_textWrite(curConvo->tempMsg.msg, curConvo->tempMsg.msgLen);
+        Adafruit_RA8875_textWrite(myself->draft.msg, myself->draft.msgLen);
     }
     
     /* Print the button labels */
@@ -765,8 +814,10 @@ void drawCompose(){
 
 void drawDetails(void *user){
     char str[50];
+    NAV_Solution nav;
     
     curDetails = user;
+    readNav(&myself->nav, &nav);
     
     /* Print the buttons */
     Adafruit_RA8875_graphicsMode(); CyDelay(20);
@@ -794,10 +845,10 @@ void drawDetails(void *user){
 
         Adafruit_RA8875_textSetCursor(200, 10);
         // Easy way to test for a valid position
-        if (myself->rmc.latDir) {
+        if (nav.latDir) {
             Adafruit_RA8875_textWrite("Position:", 9);
             Adafruit_RA8875_textSetCursor(250, 10);
-            sprintf(str, "%0.4f, %0.4f", myself->rmc.lat, myself->rmc.lon);
+            coordString(str, nav.lat, nav.lon);
             Adafruit_RA8875_textWrite(str, strlen(str));
         }
         else {
@@ -806,6 +857,9 @@ void drawDetails(void *user){
     }
     else if (user){
         User *u = (User*)user;
+        Position p;
+        
+        predictUser(u, msTicks, &p);
         //Adafruit_RA8875_textEnlarge(1);
         Adafruit_RA8875_textTransparent(RA8875_WHITE);
         Adafruit_RA8875_textSetCursor(100, 10);
@@ -817,17 +871,17 @@ void drawDetails(void *user){
 
         Adafruit_RA8875_textSetCursor(200, 10);
         // Easy way to test for a valid position
-        if (u->pos.latDir) {
+        if (p.latDir) {
             Adafruit_RA8875_textWrite("Position:", 9);
             Adafruit_RA8875_textSetCursor(250, 10);
-            sprintf(str, "%0.4f, %0.4f", u->pos.lat, u->pos.lon);
+            coordString(str, p.lat, p.lon);
             Adafruit_RA8875_textWrite(str, strlen(str));
             Adafruit_RA8875_textSetCursor(300, 10);
             Adafruit_RA8875_textWrite("Distance:", 9);
             Adafruit_RA8875_textSetCursor(350, 10);
-            if (myself->rmc.latDir) {
-                sprintf(str, "%0.2f miles", distance(u->pos.lat, u->pos.lon, myself->rmc.lat, 
-                 myself->rmc.lon, NULL, NULL));
+            if (nav.latDir) {
+                milesString(str, distance(p.lat, p.lon, nav.lat, 
+                 nav.lon, NULL, NULL), 2, "miles");
                 Adafruit_RA8875_textWrite(str, strlen(str));
             }
             else
@@ -863,6 +917,10 @@ void drawDetails(void *user){
 */
 void goToMenu(Menu m, void *arg) {
     curMenu = m;
+    // The user being shown mustn't be dropped from under us
+    myself->users.keep = NULL;
+    if (m == MENU_CONVERSATION || m == MENU_COMPOSE || (m == MENU_INFO_DETAILS && arg != myself))
+        myself->users.keep = arg;
     
     switch(m) {
         case MENU_HOME:
@@ -6,6 +6,7 @@
 #include "users.h"
 #include "nmea.h"
 #include "xbee.h"
+#include "gps.h"
 
 // Since all buttons are the same size I can use this macro
 #define BUTTON_HIT(_T_X, _T_Y, _B_X, _B_Y)\
@@ -20,6 +21,11 @@
     _MEM_IND;\
 }
     
+// The GPS rate buttons are narrower to fit GPS_NUM_RATES of them
+#define GPS_BUTTON_Y(_I) (5 + (_I) * 95)
+#define GPS_BUTTON_HIT(_T_X, _T_Y, _I)\
+   (_T_X >= 370 && _T_X <= 420 && _T_Y >= GPS_BUTTON_Y(_I) && _T_Y <= GPS_BUTTON_Y(_I) + 90)
+    
 #define CHAR_PER_LINE 30
 #define PIX_PER_LINE 32
 #define MAX_LINES 20
@@ -50,18 +56,20 @@ Self *myself;
 void *curDetails; // Keeps track of whose details are being shown
 User *curConvo;   // Keeps track of whose converstion is being shown
 
-// Keeps track of what GPS and XBee settings we're at
-int GPS_Rate;
+// Keeps track of what XBee setting we're at, the GPS one is gpsRate
 int XB_Rate;
 
 /* "Public" functions */
 void Disp_FurtherInit(Self *me, uint16 *calX, uint16 *calY);
 void Disp_Refresh_Map();
+void Disp_Refresh_Users();
 void Disp_Update_Time(int force);
 int  Disp_Get_Touch(uint16 *x, uint16 *y);
 void Disp_touchResponse(int x, int y);
 
 /* "Private" functions */
+void milesString(char *str, uint32 meters, int decimals, const char *unit);
+void coordString(char *str, int32 lat, int32 lon);
 void updateMessage(int x, int y);
 void updateNameEdit(int x, int y);
 void drawHome();
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include "dmarx.h"
+
+// Points one of the TDs back at the start of its half of the buffer
+static void armTd(DMA_Rx *rx, uint8 half) {
+    CyDmaTdSetConfiguration(rx->td[half], DMARX_HALF, rx->td[!half], TD_INC_DST_ADR);
+    CyDmaTdSetAddress(rx->td[half], LO16((uintptr_t)rx->rxData),
+                      LO16((uintptr_t)(rx->buf + half * DMARX_HALF)));
+}
+
+/*
+    Sets up the TD loop on channel <ch>, which has already been
+    initialized for one byte per request from the peripheral to SRAM,
+    and starts it.
+*/
+void DMARx_Start(DMA_Rx *rx, uint8 ch, reg8 *rxData) {
+    rx->ch = ch;
+    rx->rxData = rxData;
+    rx->td[0] = CyDmaTdAllocate();
+    rx->td[1] = CyDmaTdAllocate();
+    rx->active = 0;
+    rx->tail = 0;
+    rx->numLaps = 0;
+    armTd(rx, 0);
+    armTd(rx, 1);
+    CyDmaChSetInitialTd(ch, rx->td[0]);
+    CyDmaChEnable(ch, 0); // Don't preserve TDs, so the count can be read
+}
+
+// Index of the next byte the DMA will write
+static uint8 writePos(DMA_Rx *rx) {
+    uint8 td, state;
+    uint16 left;
+
+    CyDmaChStatus(rx->ch, &td, &state);
+    if (td == rx->td[1] && rx->active == 0) {
+        // Moved on to the second half, get the first ready for next time
+        armTd(rx, 0);
+        rx->active = 1;
+    }
+    else if (td == rx->td[0] && rx->active == 1) {
+        armTd(rx, 1);
+        rx->active = 0;
+    }
+    left = CY_GET_REG16(CY_DMA_TDMEM_STRUCT_PTR[td].TD0) & 0x0FFF;
+    if (!left) {
+        // Both halves filled without a read in between, so the DMA has
+        // stopped on the TD it used last time round and is dropping
+        // bytes. Start it again on that half and drop what's buffered.
+        armTd(rx, rx->active);
+        armTd(rx, !rx->active);
+        ++rx->numLaps;
+        rx->tail = rx->active * DMARX_HALF;
+        left = DMARX_HALF;
+    }
+
+    return rx->active * DMARX_HALF + DMARX_HALF - left;
+}
+
+/*
+    Takes the next received byte, if there is one. Returns 0 when the
+    DMA hasn't written anything new. Never blocks.
+*/
+int DMARx_Read(DMA_Rx *rx, uint8 *c) {
+    uint8 head = writePos(rx) & (DMARX_LEN - 1);
+
+    if (rx->tail == head)
+        return 0;
+    // If the DMA's half has caught up with the one being read, it has
+    // gone all the way around and the oldest bytes are gone
+    if ((head ^ rx->tail) < DMARX_HALF && head < rx->tail) {
+        ++rx->numLaps;
+        rx->tail = head;
+        return 0;
+    }
+    *c = rx->buf[rx->tail];
+    rx->tail = (rx->tail + 1) & (DMARX_LEN - 1);
+    return 1;
+}
+
+// Drops everything received so far, as the UART's ClearRxBuffer does
+void DMARx_Flush(DMA_Rx *rx) {
+    rx->tail = writePos(rx) & (DMARX_LEN - 1);
+}
@@ -0,0 +1,47 @@
+#ifndef __DMARX_H
+#define __DMARX_H
+
+#include <project.h>
+
+#pragma pack(1)
+
+#define DMARX_LEN  128 // Must be a power of 2
+#define DMARX_HALF (DMARX_LEN / 2)
+
+/*
+    Streams a UART's received bytes into a circular buffer with DMA, so
+    the CPU isn't interrupted for every byte. Two TDs each fill half of
+    <buf> and chain to each other. TDs aren't preserved, so the active
+    one's count shows how far into its half the DMA has got, and a
+    finished TD has to be re-armed before the DMA comes back around to
+    it. DMARx_Read does that, and must be called at least once per half
+    buffer's worth of bytes (5 ms at 115200 baud).
+
+    Needs a DMA component in the schematic with its drq wired to the
+    UART's rx_interrupt, and the UART's RX buffer set to 4 bytes so its
+    own ISR doesn't read RXDATA as well.
+*/
+
+/*
+    TopDesign doesn't have the GPS_RX_DMA and XB_RX_DMA components yet,
+    so reception stays on the UART interrupts. Set to 1 once they are
+    added and wired as above.
+*/
+#ifndef RX_DMA
+#define RX_DMA 0
+#endif
+
+typedef struct DMA_Rx {
+    uint8  buf[DMARX_LEN];
+    reg8  *rxData; // The UART's RX data register
+    uint8  ch;
+    uint8  td[2];
+    uint8  active; // The half the DMA was last seen writing
+    uint8  tail; // Next byte to read
+    uint16 numLaps; // Times the DMA overran bytes that hadn't been read
+} DMA_Rx;
+
+void DMARx_Start(DMA_Rx *rx, uint8 ch, reg8 *rxData);
+int  DMARx_Read(DMA_Rx *rx, uint8 *c);
+void DMARx_Flush(DMA_Rx *rx);
+#endif
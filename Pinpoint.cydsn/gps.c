@@ -0,0 +1,289 @@
+#include "gps.h"
+#include "replay.h"
+#include "tick.h"
+
+/*
+    PMTK314 fields are GLL, RMC, VTG, GGA, GSA, GSV followed by 13
+    unused ones, each the number of fixes between outputs (0 = off,
+    at most 5). RMC always goes out every epoch since it carries the
+    position; the slower sentences are thinned out as the rate goes up.
+*/
+#define FULL_MIX "PMTK314,0,1,1,1,1,5,0,0,0,0,0,0,0,0,0,0,0,0,0"
+const GPS_RateConfig gpsRates[GPS_NUM_RATES] = {
+    {"1/3",   1000, 3000, "PMTK314,0,3,3,3,3,3,0,0,0,0,0,0,0,0,0,0,0,0,0", NULL},
+    {"1/2",   1000, 2000, "PMTK314,0,2,2,2,2,2,0,0,0,0,0,0,0,0,0,0,0,0,0", NULL},
+    {"1 Hz",  1000, 1000, FULL_MIX, NULL},
+    {"5 Hz",   200,  200, "PMTK314,0,1,0,5,5,0,0,0,0,0,0,0,0,0,0,0,0,0,0", FULL_MIX},
+    {"10 Hz",  100,  100, "PMTK314,0,1,0,5,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0", FULL_MIX},
+};
+
+static void setBaud(uint8 baud, uint32 now);
+static void serviceCommands(uint32 now);
+
+const GPS_Baud gpsBauds[GPS_NUM_BAUDS] = {
+    {115200, 26}, {57600, 52}, {38400, 78}, {9600, 313}
+};
+
+/* Additional GPS setup:
+ *    Find the receiver's baud rate and upgrade the link to 115200
+ *    Set update rate and NMEA output to the default of 1/2 Hz
+ * Nothing is sent here. The link is brought up and the receiver
+ * configured in the background by GPS_Service from the main loop.
+ */
+void GPS_FurtherInit() {
+    memset(&gpsCmds, 0, sizeof(gpsCmds));
+    memset(&gpsLink, 0, sizeof(gpsLink));
+    memset(&gpsClock, 0, sizeof(gpsClock));
+    gpsRate = 1;
+    setBaud(GPS_DEFAULT_BAUD, 0);
+}
+
+// Computes the checksum of <body> and writes the whole sentence to <text>
+static void buildSentence(char *text, const char *body) {
+    const char *p;
+    uint8 checksum = 0;
+    
+    for (p = body; *p; p++)
+        checksum ^= *p;
+    sprintf(text, "$%s*%02X\r\n", body, checksum);
+}
+
+// Retunes GPS_CLK to one of gpsBauds and starts verifying it. What
+// came in at the old rate is thrown away.
+static void setBaud(uint8 baud, uint32 now) {
+    GPS_CLK_SetDividerValue(gpsBauds[baud].divider);
+    GPS_ClearRxBuffer();
+#if RX_DMA
+    DMARx_Flush(&gpsDma);
+#endif
+    gpsLink.baud = baud;
+    gpsLink.numGood = 0;
+    gpsLink.since = now;
+    gpsLink.state = GPS_LINK_VERIFY;
+}
+
+/*
+    The link is verified at the target rate. Anything still queued was
+    meant for a receiver that may have reset since, so the current rate
+    is sent again from scratch.
+*/
+static void linkUp(uint32 now) {
+    uint8 rate = gpsRate;
+    
+    PC_PutString("GPS link up\r\n");
+    gpsLink.state = GPS_LINK_UP;
+    gpsLink.since = now;
+    memset(&gpsCmds, 0, sizeof(gpsCmds));
+    gpsRate = 0xFF; // Force every command out
+    GPS_SetRate(rate);
+}
+
+/*
+    Called for every sentence that passed the checksum, which proves
+    the current baud rate is right.
+*/
+void GPS_SentenceReceived(uint32 now) {
+    char body[16], text[GPS_CMD_MAX_LEN];
+    
+    gpsLink.lastGood = now;
+    if (gpsLink.state != GPS_LINK_VERIFY || ++gpsLink.numGood < GPS_LINK_SENTENCES)
+        return;
+    
+    if (gpsLink.baud == GPS_TARGET_BAUD) {
+        linkUp(now);
+    }
+    else {
+        // Ask the receiver to switch, then follow it once this is sent.
+        // There's no ACK, the receiver changes rate straight away.
+        sprintf(body, "PMTK251,%lu", (unsigned long)gpsBauds[GPS_TARGET_BAUD].rate);
+        buildSentence(text, body);
+        GPS_PutString(text);
+        gpsLink.state = GPS_LINK_SWITCH;
+        gpsLink.since = now;
+    }
+}
+
+// Longest we wait for a good sentence, allowing for slow output rates
+static uint32 linkTimeout() {
+    return 2 * GPS_EpochPeriod() + 500;
+}
+
+/*
+    Runs the link state machine and the command queue. Never blocks,
+    call it every pass of the main loop. <now> is in milliseconds.
+*/
+void GPS_Service(uint32 now) {
+    switch (gpsLink.state) {
+        case GPS_LINK_VERIFY:
+            if (now - gpsLink.since > linkTimeout()) {
+                // Nothing valid at this rate, try the next one
+                ++gpsLink.numScans;
+                setBaud((gpsLink.baud + 1) % GPS_NUM_BAUDS, now);
+            }
+            break;
+        case GPS_LINK_SWITCH:
+            // Wait for the PMTK251 to leave the UART completely
+            if ((!GPS_GetTxBufferSize() && (GPS_ReadTxStatus() & GPS_TX_STS_COMPLETE))
+                || now - gpsLink.since > 100) {
+                PC_PutString("Changing GPS baud rate\r\n");
+                setBaud(GPS_TARGET_BAUD, now);
+            }
+            break;
+        case GPS_LINK_UP:
+            if (now - gpsLink.lastGood > GPS_STALE_EPOCHS * GPS_EpochPeriod() + linkTimeout()) {
+                // e.g. the receiver browned out and came back at another rate
+                PC_PutString("GPS link lost\r\n");
+                setBaud(gpsLink.baud, now);
+            }
+            else
+                serviceCommands(now);
+            break;
+    }
+}
+
+/*
+    Reprograms the receiver for one of the gpsRates. Doesn't block;
+    the commands go out through the command queue once the link is up.
+    When speeding up, the sentence mix is thinned before the fix rate
+    goes up, and the other way around when slowing down, so the link
+    never carries the big mix at the high rate. Returns 0 if the rate is invalid or the
+    command queue is too full to take both commands.
+*/
+int GPS_SetRate(uint8 rate) {
+    char fixCmd[16];
+    const char *output;
+
+    if (rate >= GPS_NUM_RATES || gpsCmds.count > GPS_CMD_QUEUE_LEN - 2)
+        return 0;
+    if (rate == gpsRate)
+        return 1;
+    
+    sprintf(fixCmd, "PMTK220,%u", gpsRates[rate].fixPeriod);
+    output = gpsRates[rate].output;
+    if (gpsBauds[gpsLink.baud].rate >= 57600 && gpsRates[rate].fastOutput)
+        output = gpsRates[rate].fastOutput;
+    
+    if (gpsRate < GPS_NUM_RATES &&
+        gpsRates[rate].epochPeriod < gpsRates[gpsRate].epochPeriod) {
+        GPS_QueueCommand(output);
+        GPS_QueueCommand(fixCmd);
+    }
+    else {
+        GPS_QueueCommand(fixCmd);
+        GPS_QueueCommand(output);
+    }
+    gpsRate = rate;
+
+    return 1;
+}
+
+/*
+    Returns the number of milliseconds expected between epochs
+    (RMC sentences) at the current rate.
+*/
+uint32 GPS_EpochPeriod() {
+    return gpsRates[gpsRate < GPS_NUM_RATES ? gpsRate : 1].epochPeriod;
+}
+
+/*
+    Adds a command to the end of the queue. <body> is everything
+    between the '$' and the '*', e.g. "PMTK220,1000". The checksum
+    is calculated here. Returns 0 if the queue is full or the command
+    is too long.
+*/
+int GPS_QueueCommand(const char *body) {
+    GPS_Cmd *cmd;
+    
+    if (gpsCmds.count == GPS_CMD_QUEUE_LEN || strlen(body) > GPS_CMD_MAX_LEN - 7
+        || strncmp(body, "PMTK", 4))
+        return 0;
+    
+    cmd = &gpsCmds.cmd[(gpsCmds.head + gpsCmds.count) % GPS_CMD_QUEUE_LEN];
+    buildSentence(cmd->text, body);
+    cmd->cmdNum = atoi(body + 4);
+    ++gpsCmds.count;
+    
+    return 1;
+}
+
+// Drops the head command and moves on to the next one
+static void nextCommand() {
+    gpsCmds.head = (gpsCmds.head + 1) % GPS_CMD_QUEUE_LEN;
+    --gpsCmds.count;
+    gpsCmds.tries = 0;
+}
+
+/*
+    Sends the head command if it hasn't been yet, and resends or gives
+    up on it if its acknowledgement hasn't arrived in time. Never
+    blocks. <now> is in milliseconds.
+*/
+static void serviceCommands(uint32 now) {
+    if (!gpsCmds.count)
+        return;
+    
+    if (gpsCmds.tries && now - gpsCmds.sentAt < GPS_ACK_TIMEOUT)
+        return;
+    
+    if (gpsCmds.tries == GPS_CMD_TRIES) {
+        PC_PutString("GPS command timed out\r\n");
+        ++gpsCmds.numFailed;
+        nextCommand();
+        if (!gpsCmds.count)
+            return;
+    }
+    
+    GPS_PutString(gpsCmds.cmd[gpsCmds.head].text);
+    gpsCmds.sentAt = now;
+    ++gpsCmds.tries;
+}
+
+/*
+    Matches a $PMTK001 against the command waiting on it. Success moves
+    on to the next command, a failed one is sent again at the next
+    GPS_Service, and invalid or unsupported ones are dropped.
+*/
+void GPS_HandleAck(PMTK_Ack *ack) {
+    if (!gpsCmds.count || !gpsCmds.tries || ack->cmd != gpsCmds.cmd[gpsCmds.head].cmdNum)
+        return;
+    
+    switch (ack->flag) {
+        case 3: // Succeeded
+            nextCommand();
+            break;
+        case 2: // Valid but failed, try again
+            if (gpsCmds.tries < GPS_CMD_TRIES)
+                gpsCmds.sentAt -= GPS_ACK_TIMEOUT;
+            break;
+        default: // Invalid or unsupported, retrying won't help
+            PC_PutString("GPS command rejected\r\n");
+            ++gpsCmds.numFailed;
+            nextCommand();
+            break;
+    }
+}
+
+/*
+    Sets the GPS time to <utc> as of <at>, from a valid RMC whose '$'
+    arrived at <at>. Replayed logs are in the past, so while one is
+    playing the clock is left to run on from the live GPS, and lapses
+    after GPS_CLOCK_HOLDOVER.
+*/
+void GPS_SyncClock(uint32 utc, uint32 at) {
+    if (replay.mode >= REPLAY_1X)
+        return;
+    gpsClock.utc = utc;
+    gpsClock.at = at;
+    gpsClock.valid = 1;
+}
+
+/*
+    Puts the GPS time at <now> in <utc>, in milliseconds since midnight.
+    Returns 0 if there hasn't been a valid RMC in GPS_CLOCK_HOLDOVER.
+*/
+int GPS_Time(uint32 now, uint32 *utc) {
+    if (!gpsClock.valid || now - gpsClock.at > GPS_CLOCK_HOLDOVER)
+        return 0;
+    *utc = (gpsClock.utc + (now - gpsClock.at)) % 86400000UL;
+    return 1;
+}
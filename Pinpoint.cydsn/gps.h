@@ -0,0 +1,112 @@
+#ifndef __GPS_H
+#define __GPS_H
+
+#include <project.h>
+#include "nmea.h"
+#include "dmarx.h"
+
+#define GPS_CMD_QUEUE_LEN 8
+#define GPS_CMD_MAX_LEN   64   // Whole sentence, "$PMTK...*XX\r\n" and NULL
+#define GPS_ACK_TIMEOUT   1000 // Milliseconds to wait for a $PMTK001
+#define GPS_CMD_TRIES     3    // Sends before a command is given up on
+#define GPS_STALE_EPOCHS  3    // Missed epochs before a fix is considered lost
+#define GPS_NUM_RATES     5
+#define GPS_NUM_BAUDS     4
+#define GPS_TARGET_BAUD   0    // Index into gpsBauds the link is upgraded to
+#define GPS_DEFAULT_BAUD  3    // Index into gpsBauds the receiver powers up at
+#define GPS_LINK_SENTENCES 2   // Valid sentences needed to trust a baud rate
+#define GPS_CLOCK_HOLDOVER 60000 // Milliseconds GPS time is kept up from msTicks alone
+
+/*
+    A selectable output rate. The receiver always computes fixes at
+    fixPeriod; output sentences are sent every N fixes as set by the
+    PMTK314 <output> mix, which is kept small enough at high rates to
+    fit the 9600 baud link. Once the link runs at 57600 or faster the
+    fuller <fastOutput> mix is used instead.
+*/
+typedef struct GPS_RateConfig {
+    const char *label;
+    uint16      fixPeriod; // Milliseconds, sent as PMTK220
+    uint16      epochPeriod; // Milliseconds between RMC sentences
+    const char *output; // PMTK314 body
+    const char *fastOutput; // PMTK314 body for fast links
+} GPS_RateConfig;
+
+extern const GPS_RateConfig gpsRates[GPS_NUM_RATES];
+
+// GPS_CLK divider for each supported rate, with the UART
+// oversampling 8x off the 24 MHz bus clock
+typedef struct GPS_Baud {
+    uint32 rate;
+    uint16 divider;
+} GPS_Baud;
+
+extern const GPS_Baud gpsBauds[GPS_NUM_BAUDS];
+
+typedef enum {GPS_LINK_VERIFY, GPS_LINK_SWITCH, GPS_LINK_UP} gps_link_state;
+
+/*
+    State of the UART link to the receiver. In VERIFY the current baud
+    rate is trusted once GPS_LINK_SENTENCES sentences with good
+    checksums arrive; if they don't, the next rate is tried. In SWITCH
+    a PMTK251 is draining out of the UART before GPS_CLK is retuned.
+    Commands are only sent once the link is UP.
+*/
+typedef struct GPS_Link {
+    gps_link_state state;
+    uint8  baud; // Index into gpsBauds
+    uint8  numGood; // Good sentences seen while verifying
+    uint32 since; // When the current state was entered
+    uint32 lastGood; // When the last good sentence arrived
+    uint16 numScans; // Baud rates tried without success
+} GPS_Link;
+
+// A PMTK command waiting to be sent, with its checksum already added
+typedef struct GPS_Cmd {
+    uint16 cmdNum; // e.g. 220 for PMTK220, matched against the ACK
+    char   text[GPS_CMD_MAX_LEN];
+} GPS_Cmd;
+
+/*
+    Commands are sent one at a time, oldest first. The next one only
+    goes out once the receiver has acknowledged the current one or it
+    has timed out GPS_CMD_TRIES times.
+*/
+typedef struct GPS_CmdQueue {
+    GPS_Cmd cmd[GPS_CMD_QUEUE_LEN];
+    uint8   head;
+    uint8   count;
+    uint8   tries; // Times the head command has been sent, 0 if not yet
+    uint32  sentAt; // When the head command was last sent
+    uint16  numFailed;
+} GPS_CmdQueue;
+
+/*
+    GPS time carried on between fixes by msTicks. Every valid RMC
+    resyncs it, so nodes agree on it to within the receiver's output
+    latency, which is what the XBee beacon slots are aligned to.
+*/
+typedef struct GPS_Clock {
+    uint32 utc; // Milliseconds since midnight of the last valid RMC
+    uint32 at; // msTicks when its '$' arrived
+    uint8  valid;
+} GPS_Clock;
+
+GPS_CmdQueue gpsCmds;
+GPS_Link gpsLink;
+GPS_Clock gpsClock;
+uint8 gpsRate; // Index into gpsRates
+#if RX_DMA
+DMA_Rx gpsDma; // What the receiver sent, until the tick feeds it to the framer
+#endif
+
+void GPS_FurtherInit();
+int  GPS_SetRate(uint8 rate);
+uint32 GPS_EpochPeriod();
+int  GPS_QueueCommand(const char *body);
+void GPS_Service(uint32 now);
+void GPS_SentenceReceived(uint32 now);
+void GPS_HandleAck(PMTK_Ack *ack);
+void GPS_SyncClock(uint32 utc, uint32 at);
+int  GPS_Time(uint32 now, uint32 *utc);
+#endif
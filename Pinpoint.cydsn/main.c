@@ -5,30 +5,36 @@
 #include "display.h"
 #include "xbee.h"
 #include "nmea.h"
+#include "gps.h"
+#include "replay.h"
+#include "ring.h"
+#include "dmarx.h"
+#include "tick.h"
 #include "users.h"
 
 // Compiler flags -Wno-format-extra-args -Wno-unused-variable -Wno-format -Wno-strict-aliasing
 
-void logGPSdata();
+void logGPSdata(NMEA_Sentence *s);
+
+// Milliseconds since boot
+CY_ISR_PROTO(SYS_TICK);
+volatile uint32 msTicks = 0;
 
 // GPS RX buffer variables
-uint8 gpsBufLen = 0;
-char  gpsBuffer[500];
-char  gpsString[500];
-uint8 gpsReady = 0;
-
-// PC RX buffer variables
-uint32 pcBufLen = 0;
-char  pcBuffer[100];
-uint8 pcReady = 0;
-
-// XB RX buffer variables
-CY_ISR_PROTO(BRDCST_LOC);
-uint8 broadcastReady = 0;
-uint16 xbBufLen = 0;
-uint8  xbBuffer[700];
-uint8  xbUpdate[700];
-uint8 xbReady = 0;
+// The framer writes straight into the ring slot it has claimed, and
+// completed sentences wait in the ring until the main loop gets to them
+RING_DEFINE(gpsRing, NMEA_Sentence, 8); // Enough for a burst of GSV
+NMEA_Framer gpsFramer = {gpsRingSlots, &msTicks};
+uint32 gpsLastFix = 0; // When the last RMC arrived
+
+// PC RX buffer variables, for replaying recorded GPS logs
+RING_DEFINE(pcRing, NMEA_Sentence, 4);
+NMEA_Framer pcFramer = {pcRingSlots};
+
+// XB RX, the framers and their rings are in xbee.c
+#if RX_DMA
+DMA_Rx xbDma;
+#endif
 
 // TFT display variables
 CY_ISR_PROTO(TFT_REFRESH_INTER);
@@ -39,22 +45,35 @@ Self me;
 
 int main() {
     uint16 x, y, prevX, prevY;
+    NMEA_Sentence *s;
     
     // Initializing GPS UART Module
     GPS_CLK_Start();
     GPS_Start();
     GPS_TX_SetDriveMode(GPS_TX_DM_STRONG); // To reduce initial glitch output
     
+#if RX_DMA
+    // One byte per request from the UART's RX data register to SRAM
+    DMARx_Start(&gpsDma, GPS_RX_DMA_DmaInitialize(1, 1, HI16(CYDEV_PERIPH_BASE),
+                HI16(CYDEV_SRAM_BASE)), GPS_RXDATA_PTR);
+#endif
+    
     // Initializing XBee UART Module
     XB_Start();
     XB_TX_SetDriveMode(XB_TX_DM_STRONG); // To reduce initial glitch output
-    Broadcast_Timer_Start();
-    XB_Location_Broadcast_StartEx(BRDCST_LOC);
+#if RX_DMA
+    DMARx_Start(&xbDma, XB_RX_DMA_DmaInitialize(1, 1, HI16(CYDEV_PERIPH_BASE),
+                HI16(CYDEV_SRAM_BASE)), XB_RXDATA_PTR);
+#endif
     
     // Initializing PC UART Module
     PC_Start();
     PC_TX_SetDriveMode(PC_TX_DM_STRONG); // To reduce initial glitch output
     
+    // Initializing the 1 ms system tick
+    CySysTickStart();
+    CySysTickSetCallback(0, SYS_TICK);
+    
     // Initializing TFT display
     TFT_Start();
     Display_Refresh_Timer_Start();
@@ -64,43 +83,71 @@ int main() {
     memset(&me, 0, sizeof(me));
     strncpy(me.name, "Alfred", 7); // Probably shouldn't hard-code***
     CyGetUniqueId(&me.id);
+    XB_BeaconInit(&me);
+    srand(me.id); // Relay back-offs
     
     CyGlobalIntEnable;
     
-    Disp_FurtherInit(&me, &prevX, &prevY);
+#if XB_API_MODE
+    XB_ConfigureApi();
+#endif
     GPS_FurtherInit();
+    Disp_FurtherInit(&me, &prevX, &prevY);
 
     Display_Refresh_Timer_ReadStatusRegister();
     refreshReady = 0;
-    Broadcast_Timer_ReadStatusRegister();
-    broadcastReady = 0;
     
 // **************
-me.users = calloc(sizeof(User), 1);
-memcpy(me.users->name, "Beth", 4);
-me.users->uniqueID = 42069;
+memcpy(findUser(&me.users, 42069, 1)->name, "Beth", 4);
     
     while(1) {
-        if (gpsReady) {
+        GPS_Service(msTicks);
+        if ((s = Ring_Peek(&gpsRing))) {
             //PC_PutString("GPS\r\n");
-            logGPSdata();
-            gpsReady = 0;
+            GPS_SentenceReceived(msTicks); // Checksum passed, so the baud rate is right
+            if (replay.mode == REPLAY_MIRROR)
+                Replay_Mirror(s);
+            // The live GPS is ignored while a log is being replayed
+            if (replay.mode < REPLAY_1X)
+                logGPSdata(s);
+            Ring_Release(&gpsRing);
         }
-        if (xbReady) {
-            //PC_PutString("\tXBEE User\r\n");
-            logXBdata(&me, xbUpdate);
-            xbReady = 0;
+        if ((s = Ring_Peek(&pcRing))) {
+            if (Replay_Control(s, replay.mode < REPLAY_1X ? &gpsFramer : &pcFramer,
+                               replay.mode < REPLAY_1X ? &gpsRing : &pcRing))
+                Ring_Release(&pcRing);
+            else if (replay.mode < REPLAY_1X)
+                Ring_Release(&pcRing);
+            else if (Replay_Due(s, msTicks)) {
+                logGPSdata(s);
+                Replay_Release();
+                Ring_Release(&pcRing);
+            }
         }
+        if (viewNav(&me.nav)->latDir && msTicks - gpsLastFix > GPS_STALE_EPOCHS * GPS_EpochPeriod()) {
+            // The receiver has gone quiet for several epochs at the
+            // current rate, so stop trusting the last position
+            expireNav(&me.nav);
+        }
+        XB_RxService(&me);
         if (refreshReady) {
             //PC_PutString("Refresh\r\n");
             Display_Refresh_Timer_ReadStatusRegister();
             Disp_Update_Time(0);
+            expireUsers(&me.users, msTicks, XB_KEEPALIVE);
+            if (me.users.changed) {
+                me.users.changed = 0;
+                Disp_Refresh_Users();
+            }
+            // Other users' estimated positions move on between beacons
+            else if (curMenu == MENU_HOME && usersMoving(&me.users))
+                Disp_Refresh_Map();
             refreshReady = 0;
         }
-        if (broadcastReady) {
+        XB_RelayService(&me, msTicks);
+        if (XB_BeaconDue(&me, msTicks)) {
             //PC_PutString("\t\tBroadcast\r\n");
             broadcastPosition(&me);
-            broadcastReady = 0;
         }
         if (Disp_Get_Touch(&x, &y) && x != prevX && y != prevY) {
             prevX = x;
@@ -114,97 +161,94 @@ me.users->uniqueID = 42069;
     }
 }
 
-void logGPSdata() {
+/*
+    Parses a sentence handed over by the GPS or PC RX ISR. Interrupts
+    stay enabled; the ISR won't reuse the ring slot until it is
+    released.
+*/
+void logGPSdata(NMEA_Sentence *s) {
     char gpsInfo[100]; // Largest structure is 98 bytes long.
+    nmea_type type;
     
-    CyGlobalIntDisable;
-    switch(parseNMEA(gpsString, gpsInfo)) {
+    switch(type = parseNMEA(s, gpsInfo)) {
         case GGA:
-            memcpy(&me.gga, gpsInfo, sizeof(GGA_Str));
-            break;
         case GSA:
-            memcpy(&me.gsa, gpsInfo, sizeof(GSA_Str));
-            break;
         case VTG:
-            memcpy(&me.vtg, gpsInfo, sizeof(VTG_Str));
+            fuseNav(&me.nav, type, gpsInfo);
             break;
         case RMC:
-            memcpy(&me.rmc, gpsInfo, sizeof(RMC_Str));
+            fuseNav(&me.nav, type, gpsInfo);
+            gpsLastFix = msTicks;
+            if (((RMC_Str*)gpsInfo)->status == 'A')
+                GPS_SyncClock(((RMC_Str*)gpsInfo)->utc, s->at);
             break;
         case GSV:
-            memcpy(&me.gsv, gpsInfo, sizeof(GSV_Str));
+            assembleGSV(&me.gsv, (GSV_Msg*)gpsInfo);
+            break;
+        case PMTK_ACK:
+            GPS_HandleAck((PMTK_Ack*)gpsInfo);
             break;
         case INVALID:
         default:
             PC_PutString("Invalid NMEA string.\r\n");
             break;
     }
-    CyGlobalIntEnable;
 }
 
+// Runs one received GPS character through the framer. Only verified
+// sentences make it to the main loop.
+static void rxGPS(char c) {
+    if (feedNMEA(&gpsFramer, c)) { // End of packet
+        Ring_Commit(&gpsRing);
+        gpsFramer.s = Ring_Claim(&gpsRing);
+    }
+}
+
+#if !RX_DMA
 void GPS_RXISR_ExitCallback() {
-    CyGlobalIntDisable;
-    // Keep adding chars to the buffer until you
+    // Feed every char to the framer until you
     // exhaust the internal buffer
-    // Will break for more than one string at a time ********************
-    while(GPS_GetRxBufferSize()) {
-        if ((gpsBuffer[gpsBufLen++] = GPS_GetChar()) == '\n') { // End of packet
-            gpsBuffer[gpsBufLen] = 0;
-            gpsReady = 1;
-            strcpy(gpsString, gpsBuffer);
-            gpsBufLen = 0;
-        }
-    }
-    CyGlobalIntEnable;
+    while(GPS_GetRxBufferSize())
+        rxGPS(GPS_GetChar());
 }
+#endif
 
 // Really only used for testing. The PC will not be connected during operation
 void PC_RXISR_ExitCallback() {
-    CyGlobalIntDisable;
-    // Keep adding chars to the buffer until you
-    // exhaust the internal buffer
-    // Will break for more than one string at a time ********************
+    // Feed every char to the framer until you
+    // exhaust the internal buffer. Overflows only happen if the PC
+    // ignores XOFF or replays faster than the main loop keeps up.
     while(PC_GetRxBufferSize()) {
-        if ((gpsBuffer[gpsBufLen++] = PC_GetChar()) == '\n') { // End of packet
-            gpsBuffer[gpsBufLen] = 0;
-            //gpsReady = 1;
-            strcpy(gpsString, gpsBuffer);
-            gpsBufLen = 0;
+        if (feedNMEA(&pcFramer, PC_GetChar())) { // End of packet
+            Ring_Commit(&pcRing);
+            pcFramer.s = Ring_Claim(&pcRing);
         }
     }
-    CyGlobalIntEnable;
 }
 
+#if !RX_DMA
 void XB_RXISR_ExitCallback(){
-    XBEE_Header *hdr = (XBEE_Header*) xbBuffer;
-
-    CyGlobalIntDisable;
-    
-    while(XB_GetRxBufferSize()) {
-        if (xbBufLen > 2 && (xbBuffer[xbBufLen - 1] == '*' && 
-                             xbBuffer[xbBufLen - 2] == '*' &&
-                             xbBuffer[xbBufLen - 3] == '*')) {
-            if ((hdr->type == MESSAGE  && xbBufLen == sizeof(XBEE_Header) +  sizeof(XBEE_Message)  + 3) ||
-                (hdr->type == POSITION && xbBufLen == sizeof(XBEE_Header) +  sizeof(XBEE_Position) + 3)) {
-                // Transfering data to the second buffer
-                if (hdr->destID == 0 || hdr->destID == me.id) {
-                    xbReady = 1;
-                    memcpy(xbUpdate, xbBuffer, xbBufLen);
-                }
-            }
-            xbBufLen = 0;
-        }
-        else {
-            xbBuffer[xbBufLen++] = XB_ReadRxData();
-        }
-    }
-    CyGlobalIntEnable;
+    while(XB_GetRxBufferSize())
+        XB_RxByte(XB_ReadRxData());
 }
+#endif
 
 CY_ISR(TFT_REFRESH_INTER) {
     refreshReady = 1;
 }
 
-CY_ISR(BRDCST_LOC) {
-    broadcastReady = 1;
+CY_ISR(SYS_TICK) {
+    uint8 c;
+    
+    ++msTicks;
+    // With DMA reception the tick is what wakes the framers, instead
+    // of an interrupt per byte
+#if RX_DMA
+    while (DMARx_Read(&gpsDma, &c))
+        rxGPS(c);
+#endif
+#if RX_DMA
+    while (DMARx_Read(&xbDma, &c))
+        XB_RxByte(c);
+#endif
 }
\ No newline at end of file
@@ -1,205 +1,641 @@
 #include "nmea.h"
 
-/* Additional GPS setup:
- *    Temporarily kill all sentence output & clear buffer
- *    Set baudrate to 115200 (divider = 26 for 24 MHz clock)
- *    Set update rate to once per second
- *    Set NMEA output to be only RMC and GSA at every two seconds
- */
-void GPS_FurtherInit() {
-    CyDelay(1000);
-    // Kill sentence output
-    GPS_PutString("$PMTK314,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\r\n");
-    PC_PutString("Killing output\r\n");
-    GPS_ClearRxBuffer();
-    CyDelay(500); // Delay half a second to collect acknowledgement
-    GPS_ClearRxBuffer();
-    
-    /*// Update the baud rate on the GPS chip and GPS UART module
-    GPS_PutString("$PMTK251,115200*1F\r\n");
-    GPS_CLK_SetDividerValue(26);
-    PC_PutString("Changing baud rate\r\n");
-    CyDelay(500); // Delay half a second to collect acknowledgement
-    GPS_ClearRxBuffer();*/
-    
-    // Set GPS chip fix rate to 1 Hz
-    GPS_PutString("$PMTK220,1000*1F\r\n");
-    PC_PutString("Changing update rate\r\n");
-    CyDelay(500); // Delay half a second to collect acknowledgement
-    GPS_ClearRxBuffer();
-    
-    // Set GPS chip output to 0.5 Hz for RMC and GSA
-    GPS_PutString("$PMTK314,0,2,0,2,2,0,0,0,0,0,0,0,0,0,0,0,0,0,0*2A\r\n");
-    PC_PutString("Restarting output\r\n");
-    CyDelay(500); // Delay half a second to collect acknowledgement
-    GPS_ClearRxBuffer();
+/*
+   Field converters. These replace sscanf/atof, which are far too slow
+   on the PSoC's soft-float library. Each one stops at the first
+   character that isn't part of the number, so an empty field is 0.
+   Values too big for the result saturate instead of wrapping, since
+   a corrupted field can still carry a valid checksum.
+*/
+#define FIELD_MAX 0x7FFFFFFFL
+
+static uint32 fieldUint(const char *s) {
+   uint32 val = 0;
+
+   for (; *s >= '0' && *s <= '9'; s++) {
+      if (val > (FIELD_MAX - 9) / 10)
+         return FIELD_MAX;
+      val = val * 10 + (*s - '0');
+   }
+   return val;
+}
+
+/*
+   Converts a decimal field to fixed point with <decimals> digits after
+   the point, e.g. "12.3" with 2 decimals gives 1230. Extra digits are
+   truncated.
+*/
+static int32 fieldFixed(const char *s, int decimals) {
+   int32 val = 0;
+   int neg = 0, frac = -1;
+
+   if (*s == '-') {
+      neg = 1;
+      ++s;
+   }
+   for (; *s && frac < decimals; s++) {
+      if (*s == '.' && frac < 0)
+         frac = 0;
+      else if (*s < '0' || *s > '9')
+         break;
+      else if (val > (FIELD_MAX - 9) / 10)
+         return neg ? -FIELD_MAX : FIELD_MAX;
+      else {
+         val = val * 10 + (*s - '0');
+         if (frac >= 0)
+            ++frac;
+      }
+   }
+   for (frac = frac < 0 ? 0 : frac; frac < decimals; frac++) {
+      if (val > FIELD_MAX / 10)
+         return neg ? -FIELD_MAX : FIELD_MAX;
+      val *= 10;
+   }
+
+   return neg ? -val : val;
 }
 
+// Converts a "hhmmss.sss" field to milliseconds since midnight
+uint32 fieldTime(const char *s) {
+   uint32 hhmmss = fieldFixed(s, 3);
+   uint32 ms = hhmmss % 100000;
+   uint32 hhmm = hhmmss / 100000;
+
+   return ((hhmm / 100) * 60 + hhmm % 100) * 60000 + ms;
+}
+
+static char fieldChar(const char *s) {
+   return *s;
+}
+
+// Returns the value of a hex digit, or -1 if it isn't one
+static int hexDigit(char c) {
+   if (c >= '0' && c <= '9')
+      return c - '0';
+   else if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+   else if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   return -1;
+}
+
+/*
+   Feeds one received character to the framer. Returns a pointer to the
+   finished sentence when <c> is the '\n' that ends a sentence with a
+   matching checksum, otherwise NULL. The caller must point fr->s at a
+   new buffer before the next '$' arrives if it wants to keep the
+   returned sentence. Malformed and corrupted sentences are counted and
+   silently dropped.
+*/
+NMEA_Sentence *feedNMEA(NMEA_Framer *fr, char c) {
+   NMEA_Sentence *s = fr->s;
+   int digit;
+
+   if (c == '$') {
+      // A '$' always starts a new sentence, even mid-sentence
+      if (fr->state != NMEA_HUNT)
+         ++fr->numMalformed;
+      if (fr->clock)
+         s->at = *fr->clock;
+      s->text[0] = '$';
+      s->field[0] = 0;
+      s->numFields = 1;
+      fr->len = 1;
+      fr->calculated = 0;
+      fr->state = NMEA_BODY;
+      return NULL;
+   }
+
+   switch (fr->state) {
+      case NMEA_BODY:
+         if (c == '*') {
+            s->text[fr->len++] = '\0';
+            fr->state = NMEA_CHECKSUM_HI;
+         }
+         else if (c == '\r' || c == '\n' || fr->len >= NMEA_MAX_LEN - 1) {
+            ++fr->numMalformed;
+            fr->state = NMEA_HUNT;
+         }
+         else if (c == ',') {
+            fr->calculated ^= c;
+            if (s->numFields == NMEA_MAX_FIELDS) {
+               ++fr->numMalformed;
+               fr->state = NMEA_HUNT;
+               break;
+            }
+            s->text[fr->len++] = '\0';
+            s->field[s->numFields++] = fr->len;
+         }
+         else {
+            fr->calculated ^= c;
+            s->text[fr->len++] = c;
+         }
+         break;
+      case NMEA_CHECKSUM_HI:
+      case NMEA_CHECKSUM_LO:
+         if ((digit = hexDigit(c)) < 0) {
+            ++fr->numMalformed;
+            fr->state = NMEA_HUNT;
+         }
+         else if (fr->state == NMEA_CHECKSUM_HI) {
+            fr->checksum = digit << 4;
+            fr->state = NMEA_CHECKSUM_LO;
+         }
+         else {
+            fr->checksum |= digit;
+            fr->state = NMEA_END;
+         }
+         break;
+      case NMEA_END:
+         if (c == '\r')
+            break;
+         fr->state = NMEA_HUNT;
+         if (c != '\n')
+            ++fr->numMalformed;
+         else if (fr->checksum != fr->calculated)
+            ++fr->numBadChecksum;
+         else
+            return s;
+         break;
+      case NMEA_HUNT:
+      default:
+         break;
+   }
+
+   return NULL;
+}
+
+/*
+   Sentence handlers. Each one fills in its struct from the fields of a
+   sentence and returns its type, or INVALID if fields are missing.
+   fld[0] is the address field.
+*/
+static nmea_type parseGGA(char **fld, int numFields, void *strStruct) {
+   GGA_Str *gga = (GGA_Str*)strStruct;
+
+   if (numFields < 14)
+      return INVALID;
+   gga->utc           = fieldTime(fld[1]);
+   gga->latDir        = fieldChar(fld[3]);
+   gga->lat           = DDMtoDD(fld[2], gga->latDir);
+   gga->lonDir        = fieldChar(fld[5]);
+   gga->lon           = DDMtoDD(fld[4], gga->lonDir);
+   gga->fix           = fieldUint(fld[6]);
+   gga->numSats       = fieldUint(fld[7]);
+   gga->hdop          = fieldFixed(fld[8], 2);
+   gga->alt           = fieldFixed(fld[9], 2);
+   gga->altUnits      = fieldChar(fld[10]);
+   gga->geoidSep      = fieldFixed(fld[11], 2);
+   gga->geoidSepUnits = fieldChar(fld[12]);
+   gga->diffCorrAge   = fieldFixed(fld[13], 2);
+   return GGA;
+}
+
+static nmea_type parseGSA(char **fld, int numFields, void *strStruct) {
+   GSA_Str *gsa = (GSA_Str*)strStruct;
+   int i;
+
+   if (numFields < 18)
+      return INVALID;
+   gsa->mode1 = fieldChar(fld[1]);
+   gsa->mode2 = fieldUint(fld[2]);
+   for (i = 0; i < 12; i++)
+      gsa->satsUsed[i] = fieldUint(fld[3 + i]);
+   gsa->pdop  = fieldFixed(fld[15], 2);
+   gsa->hdop  = fieldFixed(fld[16], 2);
+   gsa->vdop  = fieldFixed(fld[17], 2);
+   return GSA;
+}
+
+static nmea_type parseGSV(char **fld, int numFields, void *strStruct) {
+   GSV_Msg *gsv = (GSV_Msg*)strStruct;
+   int i;
+
+   if (numFields < 4)
+      return INVALID;
+   gsv->talker   = fld[0][2];
+   gsv->msgCount = fieldUint(fld[1]);
+   gsv->msgNum   = fieldUint(fld[2]);
+   gsv->numSats  = fieldUint(fld[3]);
+   if (!gsv->msgNum || gsv->msgNum > gsv->msgCount)
+      return INVALID;
+
+   for (i = 4, gsv->count = 0; i + 3 < numFields && gsv->count < 4; i += 4) {
+      GSV_Sat *sat = gsv->sat + gsv->count++;
+      sat->talker    = gsv->talker;
+      sat->id        = fieldUint(fld[i]);
+      sat->elevation = fieldUint(fld[i + 1]);
+      sat->azimuth   = fieldUint(fld[i + 2]);
+      sat->snr       = fieldUint(fld[i + 3]);
+   }
+   return GSV;
+}
+
+static nmea_type parseRMC(char **fld, int numFields, void *strStruct) {
+   RMC_Str *rmc = (RMC_Str*)strStruct;
+
+   if (numFields < 12)
+      return INVALID;
+   rmc->utc          = fieldTime(fld[1]);
+   rmc->status       = fieldChar(fld[2]);
+   rmc->latDir       = fieldChar(fld[4]);
+   rmc->lat          = DDMtoDD(fld[3], rmc->latDir);
+   rmc->lonDir       = fieldChar(fld[6]);
+   rmc->lon          = DDMtoDD(fld[5], rmc->lonDir);
+   rmc->groundSpeed  = fieldFixed(fld[7], 2);
+   rmc->groundCourse = fieldFixed(fld[8], 2);
+   rmc->date         = fieldUint(fld[9]);
+   rmc->magVar       = fieldFixed(fld[10], 2);
+   rmc->magVarDir    = fieldChar(fld[11]);
+   // Some modules don't implement mode
+   rmc->mode         = numFields > 12 ? fieldChar(fld[12]) : 0;
+   return RMC;
+}
+
+static nmea_type parseVTG(char **fld, int numFields, void *strStruct) {
+   VTG_Str *vtg = (VTG_Str*)strStruct;
+   int i;
+
+   if (numFields < 9)
+      return INVALID;
+   for (i = 0; i < 2; i++) {
+      vtg->course[i]     = fieldFixed(fld[1 + 2 * i], 2);
+      vtg->reference[i]  = fieldChar(fld[2 + 2 * i]);
+      vtg->speed[i]      = fieldFixed(fld[5 + 2 * i], 2);
+      vtg->speedUnits[i] = fieldChar(fld[6 + 2 * i]);
+   }
+   // Some modules don't implement mode
+   vtg->mode = numFields > 9 ? fieldChar(fld[9]) : 0;
+   return VTG;
+}
+
+// MediaTek proprietary sentences. Only the acknowledgement is handled.
+static nmea_type parsePMTK(char **fld, int numFields, void *strStruct) {
+   PMTK_Ack *ack = (PMTK_Ack*)strStruct;
+
+   if (strcmp(fld[0] + 5, "001") || numFields < 3)
+      return INVALID;
+   ack->cmd  = fieldUint(fld[1]);
+   ack->flag = fieldUint(fld[2]);
+   return PMTK_ACK;
+}
+
+/*
+   Sentence dispatch table, keyed on the sentence formatter packed with
+   NMEA_CODE. The talker ID is ignored, so $GPRMC, $GNRMC, $GLRMC etc.
+   all go to the same handler. To support a new sentence, add a handler
+   above, a type to nmea_type, and a row here.
+*/
+static const NMEA_Handler handlers[] = {
+   {NMEA_CODE('G', 'G', 'A'), parseGGA},
+   {NMEA_CODE('G', 'S', 'A'), parseGSA},
+   {NMEA_CODE('G', 'S', 'V'), parseGSV},
+   {NMEA_CODE('R', 'M', 'C'), parseRMC},
+   {NMEA_CODE('V', 'T', 'G'), parseVTG},
+   {NMEA_PROPRIETARY | NMEA_CODE('M', 'T', 'K'), parsePMTK},
+};
+
 /* 
    This function parses the given sentence and puts the data in the
    struct pointed to by strStruct. Assumes strStruct is large enough
    to store the necessary data. To be safe, allocate as much memory as
-   needed for the largest struct. Assumes the sentence is NULL-
-   terminated. Returns the type of struct strStruct was used as. If
-   the sentence is invalid, returns INVALID type and modifications to
-   strStruct are undefined.
+   needed for the largest struct. Assumes the sentence was produced by
+   feedNMEA, so it is already split and its checksum verified. Returns
+   the type of struct strStruct was used as. If the sentence is
+   invalid or has no handler, returns INVALID type and modifications
+   to strStruct are undefined.
 */
-nmea_type parseNMEA(char *sentence, void *strStruct) {
-   nmea_type type;
-   char *p = sentence + 7;
-   int i, gsvMsgNum, satNum, maxSatNum, numSats = 0;
+nmea_type parseNMEA(NMEA_Sentence *s, void *strStruct) {
+   char *fld[NMEA_MAX_FIELDS];
+   char *addr = NMEA_FIELD(s, 0);
+   uint32 code;
+   int i;
 
-   if (!validateChecksum(sentence))
+   // Standard addresses are '$', a two character talker ID and a
+   // three character sentence formatter. Proprietary ones are "$P",
+   // a three character manufacturer code and anything after that.
+   if (addr[1] == 'P' && strlen(addr) >= 5)
+      code = NMEA_PROPRIETARY | NMEA_CODE(addr[2], addr[3], addr[4]);
+   else if (strlen(addr) == 6)
+      code = NMEA_CODE(addr[3], addr[4], addr[5]);
+   else
       return INVALID;
 
-   if (!strncmp(sentence, "$GPGGA", 6)) {
-      type = GGA;
-      extract(type, p, "%lf", GGA_Str, strStruct, utc);
-      extract(type, p, "%lf", GGA_Str, strStruct, lat);
-      extract(type, p, "%c",  GGA_Str, strStruct, latDir);
-      extract(type, p, "%lf", GGA_Str, strStruct, lon);
-      extract(type, p, "%c",  GGA_Str, strStruct, lonDir);
-      extract(type, p, "%hu", GGA_Str, strStruct, fix);
-      extract(type, p, "%hu", GGA_Str, strStruct, numSats);
-      extract(type, p, "%f",  GGA_Str, strStruct, hdop);
-      extract(type, p, "%lf", GGA_Str, strStruct, alt);
-      extract(type, p, "%c",  GGA_Str, strStruct, altUnits);
-      extract(type, p, "%f",  GGA_Str, strStruct, geoidSep);
-      extract(type, p, "%c",  GGA_Str, strStruct, geoidSepUnits);
-      extract(type, p, "%f",  GGA_Str, strStruct, diffCorrAge);
-    
-      // Convert to signed Decimal Degree format
-      GGA_Str *gga = (GGA_Str*)strStruct;
-      gga->lat = gga->latDir == 'S' ? -1 * DDMtoDD(gga->lat) : DDMtoDD(gga->lat);
-      gga->lon = gga->lonDir == 'W' ? -1 * DDMtoDD(gga->lon) : DDMtoDD(gga->lon);
-   }
-   else if (!strncmp(sentence, "$GPGSA", 6)) {
-      type = GSA;
-      extract(type, p, "%c",  GSA_Str, strStruct, mode1);
-      extract(type, p, "%hu", GSA_Str, strStruct, mode2);
-      for (i = 0; i < 12; i++)
-         extract(type, p, "%hu", GSA_Str, strStruct, satsUsed[i]);
-      extract(type, p, "%f",  GSA_Str, strStruct, pdop);
-      extract(type, p, "%f",  GSA_Str, strStruct, hdop);
-      extract(type, p, "%f",  GSA_Str, strStruct, vdop);
+   for (i = 0; i < s->numFields; i++)
+      fld[i] = NMEA_FIELD(s, i);
+
+   for (i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+      if (handlers[i].code == code)
+         return handlers[i].parse(fld, s->numFields, strStruct);
    }
-   else if (!strncmp(sentence, "$GPGSV", 6)) {
-      type = GSV;
-      // Don't care about the number of messages. Just scanning the
-      // message number.
-      if (!sscanf(p + 2, "%d", &gsvMsgNum))
-         type = INVALID;
-      else {
-         p += 4;
-         --gsvMsgNum;
-      }
-      extract(type, p, "%hu", GSV_Str, strStruct, numSats);
-      satNum = gsvMsgNum * 4;
-      maxSatNum = numSats > satNum + 3 ? satNum + 3 : numSats;
-      while (satNum <= maxSatNum) {
-         extract(type, p, "%hu", GSV_Str, strStruct, satID[satNum]);
-         extract(type, p, "%hu", GSV_Str, strStruct, elevation[satNum]);
-         extract(type, p, "%hu", GSV_Str, strStruct, azimuth[satNum]);
-         extract(type, p, "%hu", GSV_Str, strStruct, snr[satNum++]);
-      }
 
-      // Clear the memory of the later satellites. This means GSV
-      // messages must be received in order.
-      while (satNum < 12) {
-         ((GSV_Str *)strStruct)->satID[satNum] = 0;
-         ((GSV_Str *)strStruct)->elevation[satNum] = 0;
-         ((GSV_Str *)strStruct)->azimuth[satNum] = 0;
-         ((GSV_Str *)strStruct)->snr[satNum++] = 0;
+   return INVALID;
+}
+
+/*
+   Adds one GSV sentence to the group being assembled. A group has to
+   arrive in order, starting at message 1; anything else drops the
+   group in progress and leaves the published view alone. Returns 1
+   when the sentence completed a group and a new view was published.
+*/
+int assembleGSV(GSV_Assembler *a, GSV_Msg *msg) {
+   GSV_Str *back = &a->view[!a->front];
+   GSV_Str *front = &a->view[a->front];
+   int i;
+
+   if (msg->msgNum == 1) {
+      if (a->nextMsg)
+         ++a->numDropped;
+      // Start from the other constellations in the current view
+      back->numSats = 0;
+      for (i = 0; i < front->numSats; i++) {
+         if (front->sat[i].talker != msg->talker)
+            back->sat[back->numSats++] = front->sat[i];
       }
+      a->talker = msg->talker;
+      a->msgCount = msg->msgCount;
+      a->nextMsg = 1;
    }
-   else if (!strncmp(sentence, "$GPRMC", 6)) {
-      type = RMC;
-      extract(type, p, "%lf", RMC_Str, strStruct, utc);
-      extract(type, p, "%c",  RMC_Str, strStruct, status);
-      extract(type, p, "%lf", RMC_Str, strStruct, lat);
-      extract(type, p, "%c",  RMC_Str, strStruct, latDir);
-      extract(type, p, "%lf", RMC_Str, strStruct, lon);
-      extract(type, p, "%c",  RMC_Str, strStruct, lonDir);
-      extract(type, p, "%f",  RMC_Str, strStruct, groundSpeed);
-      extract(type, p, "%f",  RMC_Str, strStruct, groundCourse);
-      extract(type, p, "%6u", RMC_Str, strStruct, date);
-      extract(type, p, "%f",  RMC_Str, strStruct, magVar);
-      extract(type, p, "%c",  RMC_Str, strStruct, magVarDir);
-      if (type != INVALID) {
-         ((RMC_Str *)strStruct)->mode = 0;
-         extract(type, p, "%c",  RMC_Str, strStruct, mode);
-         type = RMC; // Some modules don't implement mode, so just reset
-      }
-    
-      // Convert to signed Decimal Degree format
-      RMC_Str *rmc = (RMC_Str*)strStruct;
-      rmc->lat = rmc->latDir == 'S' ? -1 * DDMtoDD(rmc->lat) : DDMtoDD(rmc->lat);
-      rmc->lon = rmc->lonDir == 'W' ? -1 * DDMtoDD(rmc->lon) : DDMtoDD(rmc->lon);
+   else if (!a->nextMsg || msg->msgNum != a->nextMsg ||
+            msg->talker != a->talker || msg->msgCount != a->msgCount) {
+      if (a->nextMsg)
+         ++a->numDropped;
+      a->nextMsg = 0;
+      return 0;
    }
-   else if (!strncmp(sentence, "$GPVTG", 6)) {
-      type = VTG;
-      extract(type, p, "%f", VTG_Str, strStruct, course[0]);
-      extract(type, p, "%c", VTG_Str, strStruct, reference[0]);
-      extract(type, p, "%f", VTG_Str, strStruct, course[1]);
-      extract(type, p, "%c", VTG_Str, strStruct, reference[1]);
-      extract(type, p, "%f", VTG_Str, strStruct, speed[0]);
-      extract(type, p, "%c", VTG_Str, strStruct, speedUnits[0]);
-      extract(type, p, "%f", VTG_Str, strStruct, speed[1]);
-      extract(type, p, "%c", VTG_Str, strStruct, speedUnits[1]);
-      if (type != INVALID) {
-         ((VTG_Str *)strStruct)->mode = 0;
-         extract(type, p, "%c", VTG_Str, strStruct, mode);
-         type = VTG; // Some modules don't implement mode, so just reset
+
+   for (i = 0; i < msg->count && back->numSats < NMEA_MAX_SATS; i++)
+      back->sat[back->numSats++] = msg->sat[i];
+
+   if (a->nextMsg++ < a->msgCount)
+      return 0;
+
+   // Group complete, publish it
+   back->generation = front->generation + 1;
+   a->front = !a->front;
+   a->nextMsg = 0;
+   return 1;
+}
+
+/*
+   Returns the most recently published, complete satellite view.
+*/
+GSV_Str *viewGSV(GSV_Assembler *a) {
+   return &a->view[a->front];
+}
+
+/*
+   Copies the work solution to the back buffer and swaps it to the
+   front. The generation is odd while the copy is in progress, so a
+   reader that was interrupted part way through can tell.
+*/
+static void publishNav(NAV_Assembler *a) {
+   NAV_Solution *back = &a->view[!a->front];
+   uint16 generation = a->view[a->front].generation + 2;
+
+   back->generation = generation - 1;
+   memcpy((uint8*)back + sizeof(uint16), (uint8*)&a->work + sizeof(uint16),
+          sizeof(NAV_Solution) - sizeof(uint16));
+   back->generation = generation;
+   a->front = !a->front;
+}
+
+/*
+   Adds a parsed sentence to the epoch in progress. GGA, GSA and VTG
+   only update their fields; RMC is sent every epoch at every rate, so
+   it completes the epoch and publishes it. Other types are ignored.
+   Returns 1 when a new solution was published.
+*/
+int fuseNav(NAV_Assembler *a, nmea_type type, void *strStruct) {
+   NAV_Solution *w = &a->work;
+
+   switch (type) {
+      case GGA: {
+         GGA_Str *gga = (GGA_Str*)strStruct;
+         w->fix     = gga->fix;
+         w->numSats = gga->numSats;
+         w->hdop    = gga->hdop;
+         w->alt     = gga->alt;
+         break;
+      }
+      case GSA: {
+         GSA_Str *gsa = (GSA_Str*)strStruct;
+         w->mode = gsa->mode2;
+         w->pdop = gsa->pdop;
+         w->hdop = gsa->hdop;
+         break;
+      }
+      case VTG: {
+         VTG_Str *vtg = (VTG_Str*)strStruct;
+         w->groundCourse = vtg->course[0];
+         w->groundSpeed  = vtg->speed[0];
+         break;
+      }
+      case RMC: {
+         RMC_Str *rmc = (RMC_Str*)strStruct;
+         w->utc          = rmc->utc;
+         w->date         = rmc->date;
+         w->lat          = rmc->lat;
+         w->lon          = rmc->lon;
+         w->latDir       = rmc->status == 'A' ? rmc->latDir : 0;
+         w->lonDir       = rmc->status == 'A' ? rmc->lonDir : 0;
+         w->groundSpeed  = rmc->groundSpeed;
+         w->groundCourse = rmc->groundCourse;
+         publishNav(a);
+         return 1;
       }
+      default:
+         break;
    }
-   else
-      type = INVALID;
+   return 0;
+}
 
-   return type;
+/*
+   Publishes the last solution again without its position, for when
+   the receiver has stopped sending fixes.
+*/
+void expireNav(NAV_Assembler *a) {
+   a->work.latDir = a->work.lonDir = 0;
+   publishNav(a);
 }
 
 /*
-   Expects a standard NMEA string as input. Returns zero if the
-   sentence is not valid or non-zero for a valid string. 
+   Returns the most recently published solution. Only safe to use from
+   the context that calls fuseNav; everywhere else use readNav.
 */
-int validateChecksum(char *sentence) {
-   char *temp;
-   uint16_t checksum, calculated = 0;
-   int i;
+NAV_Solution *viewNav(NAV_Assembler *a) {
+   return &a->view[a->front];
+}
 
-   // Checking for the two defining characteristics of a NMEA string
-   if (*sentence != '$' || !(temp = strchr(sentence, '*')))
-      return 0;
+/*
+   Copies the most recently published solution into <nav>. If a new
+   one is published part way through, the copy is simply taken again,
+   so this never blocks the writer and never returns a torn solution.
+*/
+void readNav(NAV_Assembler *a, NAV_Solution *nav) {
+   volatile NAV_Solution *src;
+   uint16 generation;
 
-   // Checking for a valid checksum
-   if (!sscanf(temp, "*%02hx", &checksum))
-      return 0;
+   do {
+      src = &a->view[a->front];
+      generation = src->generation;
+      memcpy(nav, (NAV_Solution*)src, sizeof(NAV_Solution));
+   } while ((generation & 1) || generation != src->generation);
+}
+
+/*
+    Converts an NMEA Degree and Decimal Minutes coordinate field
+    (e.g. "4807.0380") straight to signed Decimal Degrees in units of
+    1e-7 degrees, without going through floating point. <dir> is the
+    N/S/E/W field; S and W give negative coordinates. Fields that
+    aren't a coordinate (more than 180 degrees or 60 minutes) give 0.
+*/
+int32 DDMtoDD(const char *ddm, char dir) {
+    // Minutes to 5 decimals, so 18000.00000 still fits in an int32
+    int32 coord = fieldFixed(ddm, 5);
+    int32 degrees = coord / 10000000;
+    int32 minutes = coord % 10000000;
+    
+    if (coord < 0 || degrees > 180 || minutes >= 6000000)
+        return 0;
+    
+    // 1e-5 minutes * 1e7 / (60 * 1e5) = 1e-7 degrees, rounded
+    coord = degrees * NMEA_DEG_SCALE + (minutes * 5 + 1) / 3;
+    
+    return dir == 'S' || dir == 'W' ? -coord : coord;
+}
 
-   // Calculating the checksum from '$' to '*' (non-inclusive)
-   for (i = 1; i < temp - sentence; i++)
-      calculated ^= sentence[i];
+/*
+    Converts an RMC date (ddmmyy) and time (milliseconds since midnight)
+    to milliseconds since the start of the UTC week, Sunday 00:00.
+*/
+uint32 timeOfWeek(uint32 date, uint32 utc) {
+    static const uint8 monthOffset[12] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+    uint32 day = date / 10000;
+    uint32 month = (date / 100) % 100;
+    uint32 year = 2000 + date % 100;
+    uint32 weekday;
+    
+    if (month < 1 || month > 12)
+        return utc;
+    // Sakamoto's day of the week, 0 = Sunday
+    if (month < 3)
+        --year;
+    weekday = (year + year / 4 - year / 100 + year / 400
+               + monthOffset[month - 1] + day) % 7;
     
-   return calculated == checksum;
+    return weekday * 86400000UL + utc;
 }
 
 /*
-    Converts the NMEA Degree and Decimal Minutes coordinate format to
-    Decimal Degrees coordinate format.
+    Cosine of 0 to 90 degrees in whole degree steps, in Q15.
 */
-double DDMtoDD(double coord) {
-    int degrees = coord / 100;
-    double minutes = coord - (100 * degrees);
+static const uint16 cosTable[91] = {
+    32768, 32763, 32748, 32723, 32688, 32643, 32588, 32524, 32449, 32365,
+    32270, 32166, 32052, 31928, 31795, 31651, 31499, 31336, 31164, 30983,
+    30792, 30592, 30382, 30163, 29935, 29698, 29452, 29197, 28932, 28660,
+    28378, 28088, 27789, 27482, 27166, 26842, 26510, 26170, 25822, 25466,
+    25102, 24730, 24351, 23965, 23571, 23170, 22763, 22348, 21926, 21498,
+    21063, 20622, 20174, 19720, 19261, 18795, 18324, 17847, 17364, 16877,
+    16384, 15886, 15384, 14876, 14365, 13848, 13328, 12803, 12275, 11743,
+    11207, 10668, 10126,  9580,  9032,  8481,  7927,  7371,  6813,  6252,
+     5690,  5126,  4560,  3993,  3425,  2856,  2286,  1715,  1144,   572,
+        0
+};
+
+// Cosine of a latitude in 1e-7 degrees, in Q15, linearly interpolated
+static uint32 cosQ15(int32 lat) {
+    uint32 deg, rem;
+    
+    if (lat < 0)
+        lat = -lat;
+    if (lat >= 90 * NMEA_DEG_SCALE)
+        return 0;
+    deg = lat / NMEA_DEG_SCALE;
+    rem = lat % NMEA_DEG_SCALE;
     
-    return degrees + (minutes / 60.0);
+    return cosTable[deg] - ((uint64)(cosTable[deg] - cosTable[deg + 1]) * rem
+           + NMEA_DEG_SCALE / 2) / NMEA_DEG_SCALE;
+}
+
+static uint32 isqrt(uint64 n) {
+    uint64 root = 0, bit = (uint64)1 << 62;
+    
+    while (bit > n)
+        bit >>= 2;
+    while (bit) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+        bit >>= 2;
+    }
+    return root;
 }
 
 /*
+    Equirectangular approximation of the distance between the two
+    coordinates (in 1e-7 degrees). Returns the total distance and, if
+    latDist and lonDist aren't NULL, the north and east offsets of
+    dest from cur, all in meters. Integer math only.
+*/
+uint32 distance(int32 destLat, int32 destLon, int32 curLat, int32 curLon,
+ int32 *latDist, int32 *lonDist) {
+    // Meters per 1e-7 degree of a great circle (R = 6371 km) in Q26
+    const int64 M_PER_UNIT_Q26 = 746217;
+    int64 dLat = (int64)destLat - curLat;
+    int64 dLon = (int64)destLon - curLon;
+    int32 north, east;
     
+    // Take the short way around the antimeridian
+    if (dLon > 180 * NMEA_DEG_SCALE)
+        dLon -= 360 * NMEA_DEG_SCALE;
+    else if (dLon < -180 * NMEA_DEG_SCALE)
+        dLon += 360 * NMEA_DEG_SCALE;
+    
+    north = (dLat * M_PER_UNIT_Q26) >> 26;
+    east  = (((dLon * M_PER_UNIT_Q26) >> 11)
+          * cosQ15(destLat / 2 + curLat / 2)) >> 30;
+    
+    if (latDist)
+        *latDist = north;
+    if (lonDist)
+        *lonDist = east;
+    return isqrt((int64)north * north + (int64)east * east);
+}
+
+// Cosine of a course in centi-degrees, 0 to 36000, in signed Q15
+static int32 courseCosQ15(int32 course) {
+    if (course > 18000)
+        course = 36000 - course;
+    if (course > 9000)
+        return -(int32)cosQ15((18000 - course) * (NMEA_DEG_SCALE / 100));
+    return cosQ15(course * (NMEA_DEG_SCALE / 100));
+}
+
+/*
+    Moves the position <lat>, <lon> on by <ms> milliseconds at a
+    constant ground speed (centi-knots) and course (centi-degrees).
+    This is the model beacons are scheduled by and receivers extrapolate
+    with, so both have to agree on it.
 */
-float distance(float64 destLat, float64 destLon, float64 curLat, float64 curLon,
- float *latDist, float *lonDist) {
-    *latDist = 3959 * M_PI / 180 * (destLat - curLat);
-    *lonDist = 3959 * M_PI / 180 * (destLon - curLon)
-             * cos(M_PI / 180 * (destLat + curLat) / 2.0);
-    return sqrt(*latDist * *latDist + *lonDist * *lonDist);
-}
\ No newline at end of file
+void deadReckon(int32 *lat, int32 *lon, uint16 groundSpeed, uint16 groundCourse,
+ uint32 ms) {
+    // Millimeters per 1e-7 degree of a great circle, times 1000
+    const int64 MM_PER_UNIT_1000 = 11119;
+    // 1 centi-knot is 5.14444 mm/s
+    int64 mm = (int64)groundSpeed * ms * 514444 / 100000000;
+    int64 north = mm * courseCosQ15(groundCourse % 36000) >> 15;
+    int64 east = mm * courseCosQ15((groundCourse + 27000) % 36000) >> 15;
+    uint32 cosLat = cosQ15(*lat);
+    
+    *lat += north * 1000 / MM_PER_UNIT_1000;
+    if (cosLat)
+        *lon += (east * 1000 << 15) / MM_PER_UNIT_1000 / cosLat;
+    if (*lon > 180 * NMEA_DEG_SCALE)
+        *lon -= 360 * NMEA_DEG_SCALE;
+    else if (*lon < -180 * NMEA_DEG_SCALE)
+        *lon += 360 * NMEA_DEG_SCALE;
+}
@@ -12,98 +12,223 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-typedef enum {GGA, GSA, GSV, RMC, VTG, INVALID} nmea_type;
-
-#define extract(_type, _ptr, _format, _enumType, _struct, _pos) {\
-   char *_temp;\
-   if (_type == INVALID || *_ptr == '\0' || *_ptr == '\r')\
-      _type = INVALID;\
-   else if (*_ptr == ',') {\
-      ++_ptr;\
-      ((struct _enumType*)_struct)->_pos = 0;\
-   }\
-   else {\
-      if (!strcmp("%f", _format) || !strcmp("%lf", _format)) {\
-         /* PSOC doesn't handle foating point scanning very well */\
-         ((struct _enumType*)_struct)->_pos = atof(_ptr);\
-      }\
-      else {\
-         if (!sscanf(_ptr, _format, &((struct _enumType*)_struct)->_pos))\
-            type = INVALID;\
-      }\
-      if ((_temp = strchr(_ptr, ',')))\
-         _ptr = _temp + 1;\
-      else if((_temp = strchr(_ptr, '\0')))\
-         _ptr = _temp;\
-      else\
-         _type = INVALID;\
-   }\
-}
+typedef enum {GGA, GSA, GSV, RMC, VTG, PMTK_ACK, INVALID} nmea_type;
+
+// Packs a three character sentence formatter (e.g. "RMC") into one
+// integer so sentence types can be compared in one instruction
+#define NMEA_CODE(_a, _b, _c)\
+   (((uint32)(uint8)(_a) << 16) | ((uint32)(uint8)(_b) << 8) | (uint8)(_c))
+
+// Proprietary sentences ("$P" + manufacturer) are keyed on the three
+// character manufacturer code with this bit set
+#define NMEA_PROPRIETARY 0x01000000UL
+
+typedef nmea_type (*nmea_handler)(char **fld, int numFields, void *strStruct);
+
+typedef struct NMEA_Handler {
+   uint32       code; // NMEA_CODE of the sentence formatter
+   nmea_handler parse;
+} NMEA_Handler;
+
+// Longest sentence we accept, including the NULL. The standard caps
+// sentences at 82 characters.
+#define NMEA_MAX_LEN 96
+
+// Enough for a GSV sentence (address, 3 header fields, 4 satellites
+// of 4 fields each). Longer sentences are dropped by the framer.
+#define NMEA_MAX_FIELDS 24
+
+// Gets the NULL-terminated string of field <_i> of a sentence
+#define NMEA_FIELD(_s, _i) ((_s)->text + (_s)->field[_i])
+
+/*
+   A complete, checksum-verified sentence split into its comma-separated
+   fields. Each ',' and the '*' are replaced by a NULL and field[] holds
+   the offset of each field in text. field[0] is the address field
+   (e.g. "$GPGGA"); the checksum is not included as a field.
+*/
+typedef struct NMEA_Sentence {
+   uint32 at; // When its '$' arrived, on the framer's clock
+   uint8 numFields;
+   uint8 field[NMEA_MAX_FIELDS];
+   char  text[NMEA_MAX_LEN];
+} NMEA_Sentence;
+
+typedef enum {NMEA_HUNT, NMEA_BODY, NMEA_CHECKSUM_HI, NMEA_CHECKSUM_LO,
+   NMEA_END} nmea_state;
+
+/*
+   Incremental sentence framer, fed one byte at a time from the UART
+   ISR. The sentence is split into fields and its checksum accumulated
+   as the bytes arrive, directly into the buffer pointed to by <s>.
+   With a <clock>, each sentence is stamped with its time as the '$'
+   arrives, before any parsing delay.
+*/
+typedef struct NMEA_Framer {
+   NMEA_Sentence *s;  // Where the sentence in progress is written
+   const volatile uint32 *clock; // Optional, e.g. &msTicks
+   nmea_state state;
+   uint8  len;
+   uint8  calculated; // XOR of everything between '$' and '*'
+   uint8  checksum;   // The checksum sent with the sentence
+   uint16 numBadChecksum;
+   uint16 numMalformed;
+} NMEA_Framer;
+
+/*
+   All coordinates and velocities are fixed point, since the PSoC has
+   no FPU. Coordinates are signed (S and W are negative) in units of
+   1e-7 degrees, which is about 1 cm of latitude.
+*/
+#define NMEA_DEG_SCALE 10000000L
 
 typedef struct GGA_Str {
-   float64 utc;
-   float64 lat;
+   uint32 utc; // Milliseconds since midnight
+   int32  lat; // 1e-7 degrees
    char   latDir; // N/S
-   float64 lon;
+   int32  lon; // 1e-7 degrees
    char   lonDir; // E/W
    uint16_t fix; // 1 = No fix, 2 = GPS fix, 3 = DGPS fix
    uint16_t numSats;
-   float  hdop;
-   float64 alt;
+   uint16 hdop; // Hundredths
+   int32  alt; // Centimeters
    char   altUnits;
-   float  geoidSep;
+   int32  geoidSep; // Centimeters
    char   geoidSepUnits;
-   float  diffCorrAge;
+   uint16 diffCorrAge; // Hundredths of a second
 } GGA_Str;
 
 typedef struct GSA_Str {
    char   mode1; // M = manual, A = 2D automatic
    uint16_t mode2; // 1 = no fix, 2 = 2D (<4 sats), 3 = 3D (>=4 sats)
    uint16_t satsUsed[12]; // The SV on each channel
-   float  pdop;
-   float  hdop;
-   float  vdop;
+   uint16 pdop; // Hundredths
+   uint16 hdop; // Hundredths
+   uint16 vdop; // Hundredths
 } GSA_Str;
 
-// The arrays are filled at respective satellite channel numbers.
-// E.g. the information for the first satellite from a GSV sentence
-// will be found at position zero in the ID, elevation, azimuth, and
-// SNR arrays. Adjust the sizes of the arrays for your GPS chip's needs.
+// Most satellites in view we keep track of, across all constellations
+#define NMEA_MAX_SATS 40
+
+typedef struct GSV_Sat {
+   char   talker; // Second letter of the talker ID, e.g. 'P' = GPS, 'L' = GLONASS
+   uint8  id;
+   uint8  elevation; // In degrees
+   uint16 azimuth; // In degrees
+   uint8  snr; // 0 to 99, 0 when not tracked
+} GSV_Sat;
+
+// A single GSV sentence. Satellites are split over a group of up to
+// msgCount sentences per constellation.
+typedef struct GSV_Msg {
+   char    talker;
+   uint8   msgCount;
+   uint8   msgNum; // 1 to msgCount
+   uint8   numSats; // Total in view for this constellation
+   uint8   count; // Satellites in this sentence
+   GSV_Sat sat[4];
+} GSV_Msg;
+
+// The satellites in view. Only ever published whole by assembleGSV,
+// generation is incremented on each publication.
 typedef struct GSV_Str {
-   uint16_t  numSats;
-   uint16_t  satID[12];
-   uint16_t  elevation[12]; // In degrees
-   uint16_t  azimuth[12];
-   uint16_t  snr[12]; // 0 to 99, null when not tracked
+   uint16  generation;
+   uint8   numSats;
+   GSV_Sat sat[NMEA_MAX_SATS];
 } GSV_Str;
 
+/*
+   Collects GSV groups into the back buffer and swaps it to the front
+   once a group is complete, so the front is never half updated.
+   Satellites from other constellations are carried over from the
+   previous view.
+*/
+typedef struct GSV_Assembler {
+   GSV_Str view[2];
+   volatile uint8 front; // Index of the published view
+   char   talker; // Group being assembled
+   uint8  msgCount;
+   uint8  nextMsg; // 0 when no group is in progress
+   uint16 numDropped; // Groups dropped for being partial or out of order
+} GSV_Assembler;
+
 typedef struct RMC_Str {
-   float64 utc;
+   uint32  utc; // Milliseconds since midnight
    char    status; // A = valid, V = not valid
-   float64 lat;
+   int32   lat; // 1e-7 degrees
    char    latDir; // N/S
-   float64 lon;
+   int32   lon; // 1e-7 degrees
    char    lonDir; // E/W
-   float   groundSpeed; // In knots
-   float   groundCourse; // In degrees
+   uint16  groundSpeed; // In centi-knots
+   uint16  groundCourse; // In centi-degrees
    uint    date;
-   float   magVar; // Degrees
+   uint16  magVar; // Centi-degrees
    char    magVarDir; // E/W
    char    mode; // A = autonomous, D = differential, E = estimated
 } RMC_Str;
 
+// $PMTK001 acknowledgement of a PMTK command
+typedef struct PMTK_Ack {
+   uint16 cmd; // The command being acknowledged, e.g. 220 for PMTK220
+   uint8  flag; // 0 = invalid, 1 = unsupported, 2 = failed, 3 = succeeded
+} PMTK_Ack;
+
 typedef struct VTG_Str {
-   float course[2];
-   char  reference[2]; // T = true, M = magnetic
-   float speed[2];
-   char  speedUnits[2]; // N = knots, K = kph
-   char  mode; // A = autonomous, D = differential, E = estimated
+   uint16 course[2]; // Centi-degrees
+   char   reference[2]; // T = true, M = magnetic
+   uint16 speed[2]; // Hundredths of speedUnits
+   char   speedUnits[2]; // N = knots, K = kph
+   char   mode; // A = autonomous, D = differential, E = estimated
 } VTG_Str;
 
-void GPS_FurtherInit();
-nmea_type parseNMEA(char *sentence, void *strStruct);
-int validateChecksum(char *sentence);
-double DDMtoDD(double coord);
-float distance(float64 destLat, float64 destLon, float64 curLat, float64 curLon,
- float *latDist, float *lonDist);
+/*
+   Navigation solution for one epoch, fused from GGA, GSA, RMC and VTG.
+   The position has the same layout as Position, and latDir/lonDir are
+   0 when there is no valid fix.
+*/
+typedef struct NAV_Solution {
+   uint16 generation; // Even, +2 on each publication, odd while written
+   uint32 utc; // Milliseconds since midnight
+   uint32 date; // ddmmyy
+   int32  lat; // 1e-7 degrees
+   char   latDir; // N/S
+   int32  lon; // 1e-7 degrees
+   char   lonDir; // E/W
+   int32  alt; // Centimeters
+   uint16 groundSpeed; // In centi-knots
+   uint16 groundCourse; // In centi-degrees
+   uint16 hdop; // Hundredths
+   uint16 pdop; // Hundredths
+   uint8  fix; // GGA fix quality
+   uint8  mode; // 1 = no fix, 2 = 2D, 3 = 3D
+   uint8  numSats;
+} NAV_Solution;
+
+/*
+   Gathers the sentences of an epoch into <work> and publishes it to
+   the back buffer when the epoch's RMC arrives, then swaps it to the
+   front. Readers take a copy with readNav, so they never see one
+   epoch's position with another's time.
+*/
+typedef struct NAV_Assembler {
+   NAV_Solution view[2];
+   volatile uint8 front; // Index of the published solution
+   NAV_Solution work; // The epoch in progress
+} NAV_Assembler;
+
+NMEA_Sentence *feedNMEA(NMEA_Framer *fr, char c);
+nmea_type parseNMEA(NMEA_Sentence *s, void *strStruct);
+int assembleGSV(GSV_Assembler *a, GSV_Msg *msg);
+GSV_Str *viewGSV(GSV_Assembler *a);
+int fuseNav(NAV_Assembler *a, nmea_type type, void *strStruct);
+void expireNav(NAV_Assembler *a);
+NAV_Solution *viewNav(NAV_Assembler *a);
+void readNav(NAV_Assembler *a, NAV_Solution *nav);
+int32 DDMtoDD(const char *ddm, char dir);
+uint32 fieldTime(const char *s);
+uint32 timeOfWeek(uint32 date, uint32 utc);
+uint32 distance(int32 destLat, int32 destLon, int32 curLat, int32 curLon,
+ int32 *latDist, int32 *lonDist);
+void deadReckon(int32 *lat, int32 *lon, uint16 groundSpeed, uint16 groundCourse,
+ uint32 ms);
 #endif
\ No newline at end of file
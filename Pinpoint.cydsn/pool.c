@@ -0,0 +1,33 @@
+#include <string.h>
+#include "pool.h"
+
+/*
+    Returns a zeroed object, or NULL if they are all in use, leaving it
+    to the caller to free one by its own eviction policy.
+*/
+void *Pool_Alloc(Pool *p) {
+    void *obj;
+    
+    if (p->free) {
+        obj = p->free;
+        memcpy(&p->free, obj, sizeof(void*)); // Objects may be packed
+    }
+    else if (p->numFresh < p->numObjs)
+        obj = p->objs + (uint16)p->numFresh++ * p->objSize;
+    else {
+        ++p->numFailed;
+        return NULL;
+    }
+    
+    memset(obj, 0, p->objSize);
+    if (++p->numUsed > p->maxUsed)
+        p->maxUsed = p->numUsed;
+    return obj;
+}
+
+// Gives <obj> back to the pool it came from
+void Pool_Free(Pool *p, void *obj) {
+    memcpy(obj, &p->free, sizeof(void*));
+    p->free = obj;
+    --p->numUsed;
+}
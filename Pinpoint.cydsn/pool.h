@@ -0,0 +1,34 @@
+#pragma pack(1)
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <cytypes.h>
+#include <stddef.h>
+
+/*
+    Fixed number of fixed size objects, allocated and freed in constant
+    time without the heap. Free objects are kept on a list threaded
+    through their own first bytes; objects that have never been handed
+    out are taken in order first, so a pool needs no initialization.
+    Main loop only.
+*/
+typedef struct Pool {
+    uint8 *objs;
+    uint16 objSize; // Bytes per object, at least a pointer, any alignment
+    uint8  numObjs;
+    uint8  numFresh; // Objects handed out at least once
+    void  *free; // Freed objects
+    uint8  numUsed;
+    uint8  maxUsed; // Most objects ever in use at once
+    uint16 numFailed; // Allocations refused because the pool was full
+} Pool;
+
+// Declares the storage for a pool and a Pool using it
+#define POOL_DEFINE(_NAME, _TYPE, _NUM) \
+    _TYPE _NAME##Objs[_NUM]; \
+    Pool _NAME = {(uint8*)_NAME##Objs, sizeof(_TYPE), _NUM}
+
+void *Pool_Alloc(Pool *p);
+void  Pool_Free(Pool *p, void *obj);
+#endif
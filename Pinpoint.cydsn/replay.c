@@ -0,0 +1,162 @@
+#include "replay.h"
+
+#define DAY_MS 86400000UL
+#define RESYNC_MS 60000 // Further ahead than this and the log is taken to have restarted
+
+extern Self me; // Our own information, in main.c
+
+static void sendStats(NMEA_Framer *fr, Ring *ring);
+static void sendMem();
+
+// Converts an "hhmmss.sss" field to milliseconds since midnight, or
+// DAY_MS if it isn't a time
+static uint32 timeField(const char *t) {
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (t[i] < '0' || t[i] > '9')
+            return DAY_MS;
+    }
+    return fieldTime(t);
+}
+
+/*
+    Handles a $PPNT control sentence from the PC. Statistics include the
+    error counts of <fr> and <ring>, where sentences are currently taken
+    from.
+    Returns 1 if <s> was one, 0 if it should go on to the replay
+    pipeline.
+*/
+int Replay_Control(NMEA_Sentence *s, NMEA_Framer *fr, Ring *ring) {
+    const char *cmd = s->numFields > 1 ? NMEA_FIELD(s, 1) : "";
+    const char *arg = s->numFields > 2 ? NMEA_FIELD(s, 2) : "";
+
+    if (strcmp(NMEA_FIELD(s, 0), "$PPNT"))
+        return 0;
+
+    if (!strcmp(cmd, "MODE")) {
+        if (replay.held)
+            PC_PutChar(REPLAY_XON);
+        memset(&replay, 0, sizeof(replay));
+        if (!strcmp(arg, "MIRROR"))
+            replay.mode = REPLAY_MIRROR;
+        else if (!strcmp(arg, "1"))
+            replay.mode = REPLAY_1X;
+        else if (!strcmp(arg, "10"))
+            replay.mode = REPLAY_10X;
+        else if (!strcmp(arg, "MAX"))
+            replay.mode = REPLAY_MAX;
+        replay.startUtc = DAY_MS; // No time base yet
+    }
+    else if (!strcmp(cmd, "STAT"))
+        sendStats(fr, ring);
+    else if (!strcmp(cmd, "MEM"))
+        sendMem();
+    return 1;
+}
+
+/*
+    Returns 1 once the held replay sentence <s> is due to go through
+    the pipeline. Sentences without a time are due straight away, as
+    they belong to the epoch of the last timed one. While a sentence is
+    held the PC is paused with XOFF, so nothing behind it is dropped.
+*/
+int Replay_Due(NMEA_Sentence *s, uint32 now) {
+    uint32 utc, elapsed;
+
+    if (replay.mode == REPLAY_MAX || s->numFields < 2
+        || (utc = timeField(NMEA_FIELD(s, 1))) >= DAY_MS)
+        return 1;
+
+    if (replay.startUtc >= DAY_MS) {
+        replay.startMs = now;
+        replay.startUtc = utc;
+    }
+
+    // Log time since the first timed sentence, across midnight
+    elapsed = (utc + DAY_MS - replay.startUtc) % DAY_MS;
+    if (replay.mode == REPLAY_10X)
+        elapsed /= 10;
+    if (elapsed > now - replay.startMs + RESYNC_MS) {
+        replay.startMs = now;
+        replay.startUtc = utc;
+        elapsed = 0;
+    }
+
+    if (now - replay.startMs >= elapsed)
+        return 1;
+
+    if (!replay.held) {
+        PC_PutChar(REPLAY_XOFF);
+        replay.held = 1;
+    }
+    return 0;
+}
+
+// The main loop has taken the replay sentence, let the PC carry on
+void Replay_Release() {
+    ++replay.numSentences;
+    if (replay.held) {
+        PC_PutChar(REPLAY_XON);
+        replay.held = 0;
+    }
+}
+
+/*
+    Echoes a live GPS sentence to the PC as it was received. The framer
+    has split the text on the commas, so it is put back together and
+    the checksum recalculated.
+*/
+void Replay_Mirror(NMEA_Sentence *s) {
+    char text[NMEA_MAX_LEN + 5];
+    char *p = text;
+    const char *f;
+    uint8 checksum = 0;
+    int i;
+
+    for (i = 0; i < s->numFields; i++) {
+        if (i)
+            *p++ = ',';
+        for (f = NMEA_FIELD(s, i); *f; f++)
+            *p++ = *f;
+    }
+    *p = '\0';
+    for (p = text + 1; *p; p++)
+        checksum ^= *p;
+    sprintf(p, "*%02X\r\n", checksum);
+    PC_PutString(text);
+}
+
+/*
+    Reports the replay counters and the framer's error counts to the
+    PC, so a host script can tell at what rate sentences start being
+    lost.
+*/
+static void sendStats(NMEA_Framer *fr, Ring *ring) {
+    char body[48], text[56];
+    const char *p;
+    uint8 checksum = 0;
+
+    sprintf(body, "PPNT,STAT,%lu,%u,%u,%u", replay.numSentences,
+     ring->numOverflows, fr->numBadChecksum, fr->numMalformed);
+    for (p = body; *p; p++)
+        checksum ^= *p;
+    sprintf(text, "$%s*%02X\r\n", body, checksum);
+    PC_PutString(text);
+}
+
+// Reports how full the user pool and message arena are, see replay.h
+static void sendMem() {
+    char body[72], text[80];
+    const char *p;
+    uint8 checksum = 0;
+
+    sprintf(body, "PPNT,MEM,%u,%u,%u,%u,%u,%u,%u,%u,%u",
+     userPool.numUsed, userPool.maxUsed, userPool.numObjs, userPool.numFailed,
+     msgLog.numRecords, msgLogUsed(), MSG_ARENA_SIZE, msgLog.numEvicted,
+     me.users.numDropped);
+    for (p = body; *p; p++)
+        checksum ^= *p;
+    sprintf(text, "$%s*%02X\r\n", body, checksum);
+    PC_PutString(text);
+}
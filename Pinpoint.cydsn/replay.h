@@ -0,0 +1,45 @@
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <project.h>
+#include "nmea.h"
+#include "ring.h"
+#include "users.h"
+
+#define REPLAY_XON  0x11
+#define REPLAY_XOFF 0x13
+
+/*
+    What the PC UART is used for. In the replay modes the live GPS is
+    ignored and NMEA logs sent by the PC are fed through the same
+    parsing pipeline instead, either paced by their own timestamps
+    (1x, 10x) or as fast as they arrive (max). In mirror mode every
+    live GPS sentence is echoed to the PC so it can be recorded.
+*/
+typedef enum {REPLAY_OFF, REPLAY_MIRROR, REPLAY_1X, REPLAY_10X, REPLAY_MAX} replay_mode;
+
+/*
+    The mode is set from the PC with a $PPNT sentence, e.g.
+    "$PPNT,MODE,10*XX". "$PPNT,STAT*XX" reports the sentences released
+    and the RX errors as
+    "$PPNT,STAT,<sentences>,<ring overflows>,<bad checksum>,<malformed>".
+    "$PPNT,MEM*XX" reports the user pool and message arena as
+    "$PPNT,MEM,<users>,<most users>,<user slots>,<users refused>,
+    <messages>,<arena bytes used>,<arena size>,<messages evicted>,
+    <users dropped>".
+*/
+typedef struct Replay {
+    replay_mode mode;
+    uint8  held; // A sentence is waiting for its time, the PC has been sent XOFF
+    uint32 startMs; // When the first timed sentence was released
+    uint32 startUtc; // Its timestamp, milliseconds since midnight, or a full day if unset
+    uint32 numSentences; // Sentences released to the pipeline
+} Replay;
+
+Replay replay;
+
+int  Replay_Control(NMEA_Sentence *s, NMEA_Framer *fr, Ring *ring);
+int  Replay_Due(NMEA_Sentence *s, uint32 now);
+void Replay_Release();
+void Replay_Mirror(NMEA_Sentence *s);
+#endif
@@ -0,0 +1,42 @@
+#include "ring.h"
+
+#define SLOT(_R, _I) ((_R)->slots + (uint16)(_I) * (_R)->slotSize)
+
+/*
+    Returns the slot the producer should build its next record in. It
+    stays the same until the record is committed.
+*/
+void *Ring_Claim(Ring *r) {
+    return SLOT(r, r->head);
+}
+
+/*
+    Hands the claimed record to the consumer. If the ring is full the
+    record is dropped and counted instead, and its slot is reused for
+    the next one. Returns 0 if the record was dropped.
+*/
+int Ring_Commit(Ring *r) {
+    uint8 next = (r->head + 1) & (r->numSlots - 1);
+
+    if (next == r->tail) {
+        ++r->numOverflows;
+        return 0;
+    }
+    r->head = next;
+    return 1;
+}
+
+/*
+    Returns the oldest record waiting in the ring, or NULL if it is
+    empty. The record stays valid until it is released.
+*/
+void *Ring_Peek(Ring *r) {
+    if (r->tail == r->head)
+        return NULL;
+    return SLOT(r, r->tail);
+}
+
+// Frees the record returned by Ring_Peek for the producer to reuse
+void Ring_Release(Ring *r) {
+    r->tail = (r->tail + 1) & (r->numSlots - 1);
+}
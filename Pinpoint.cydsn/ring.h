@@ -0,0 +1,38 @@
+#pragma pack(1)
+
+#ifndef __RING_H
+#define __RING_H
+
+#include <cytypes.h>
+#include <stddef.h>
+
+/*
+    Single-producer/single-consumer ring of fixed size records, shared
+    between an RX ISR and the main loop without disabling interrupts.
+    Only the producer writes <head> and only the consumer writes <tail>.
+    The slot at <head> always belongs to the producer, which builds the
+    next record in it directly; committing it hands it to the consumer.
+    So a ring of numSlots slots holds at most numSlots - 1 records.
+*/
+typedef struct Ring {
+    uint8 *slots;
+    uint16 slotSize; // Bytes per record
+    uint8  numSlots; // Must be a power of 2
+    volatile uint8 head; // Slot the producer is filling
+    volatile uint8 tail; // Oldest record not yet released by the consumer
+    uint16 numOverflows; // Records dropped because the ring was full
+} Ring;
+
+// Declares the storage for a ring and a Ring using it
+#define RING_DEFINE(_NAME, _TYPE, _NUM) \
+    _TYPE _NAME##Slots[_NUM]; \
+    Ring _NAME = {(uint8*)_NAME##Slots, sizeof(_TYPE), _NUM}
+
+/* Producer side */
+void *Ring_Claim(Ring *r);
+int   Ring_Commit(Ring *r);
+
+/* Consumer side */
+void *Ring_Peek(Ring *r);
+void  Ring_Release(Ring *r);
+#endif
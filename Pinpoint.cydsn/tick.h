@@ -0,0 +1,9 @@
+#ifndef __TICK_H
+#define __TICK_H
+
+#include <cytypes.h>
+
+// Milliseconds since boot, counted by the SysTick ISR in main.c
+extern volatile uint32 msTicks;
+
+#endif
@@ -1,63 +1,266 @@
 #include <cylib.h>
 #include <stdlib.h>
 #include "users.h"
+#include "tick.h"
+
+POOL_DEFINE(userPool, User, MAX_USERS);
+
+// Index slot a key starts probing from
+#define HASH(_KEY) ((uint8)((uint32)((uint32)(_KEY) * 2654435761UL) >> (32 - USER_HASH_BITS)))
+#define NEXT_SLOT(_H) (((_H) + 1) & (USER_HASH_SIZE - 1))
+
+// Adds the user at <pos> in the list to both indexes
+static void indexUser(UserTable *t, uint8 pos) {
+    uint8 h;
+    
+    for (h = HASH(t->list[pos]->uniqueID); t->byID[h]; h = NEXT_SLOT(h))
+        ;
+    t->byID[h] = pos + 1;
+    for (h = HASH(t->list[pos]->shortID); t->byShortID[h]; h = NEXT_SLOT(h))
+        ;
+    t->byShortID[h] = pos + 1;
+}
+
+/*
+    Drops the user at <pos>, keeping the list in order. Linear probing
+    can't leave holes, so the indexes are built again. The user's
+    messages stay in the log until they are evicted, and show up again
+    if the user comes back.
+*/
+static void dropUser(UserTable *t, uint8 pos) {
+    uint8 i;
+    
+    Pool_Free(&userPool, t->list[pos]);
+    for (i = pos + 1; i < t->count; i++)
+        t->list[i - 1] = t->list[i];
+    --t->count;
+    memset(t->byID, 0, sizeof(t->byID));
+    memset(t->byShortID, 0, sizeof(t->byShortID));
+    for (i = 0; i < t->count; i++)
+        indexUser(t, i);
+    t->changed = 1;
+    ++t->numDropped;
+}
+
+// Makes room for a new user by dropping the least recently heard one
+static void dropOldest(UserTable *t) {
+    uint8 i, oldest = MAX_USERS;
+    
+    for (i = 0; i < t->count; i++) {
+        if (t->list[i] != t->keep && (oldest == MAX_USERS
+            || msTicks - t->list[i]->lastHeard > msTicks - t->list[oldest]->lastHeard))
+            oldest = i;
+    }
+    if (oldest < MAX_USERS)
+        dropUser(t, oldest);
+}
 
 /*
  * Returns the pointer to the user with the given ID if found,
- * or a pointer to null if not.
+ * or a pointer to null if not. With <createNew> a user that isn't
+ * found is added, in place of the least recently heard one if the
+ * table is full.
  */
-User *findUser(User **list, uint64 id, int createNew) {
-    User *temp, *cur = *list;
+User *findUser(UserTable *t, uint32 id, int createNew) {
+    uint8 h;
+    User *u;
+    MsgIter it = {0};
     
-    while (cur) {
-        if (cur->uniqueID == id)
-           break;
-        cur = cur->next;
+    for (h = HASH(id); t->byID[h]; h = NEXT_SLOT(h)) {
+        if (t->list[t->byID[h] - 1]->uniqueID == id)
+            return t->list[t->byID[h] - 1];
     }
+    if (!createNew)
+        return NULL;
+    if (t->count == MAX_USERS)
+        dropOldest(t);
+    if (!(u = Pool_Alloc(&userPool))) // Sized for MAX_USERS
+        return NULL;
     
-    if (!cur && createNew) {
-        temp = calloc(sizeof(User), 1);
-        temp->next = *list;
-        *list = cur = temp;
-        cur->uniqueID = id;
-    }
+    u->uniqueID = id;
+    u->shortID = SHORT_ID(id);
+    u->lastHeard = msTicks;
+    // Any messages from before the user was dropped
+    while (nextMessage(u, &it))
+        ++u->numMsgs;
+    t->list[t->count] = u;
+    indexUser(t, t->count++);
+    t->changed = 1;
+    
+    return u;
+}
+
+// Returns the user who goes by <shortID> in beacons, or NULL
+User *findUserByShortID(UserTable *t, uint16 shortID) {
+    uint8 s;
     
-    return cur;
+    for (s = HASH(shortID); t->byShortID[s]; s = NEXT_SLOT(s)) {
+        if (t->list[t->byShortID[s] - 1]->shortID == shortID)
+            return t->list[t->byShortID[s] - 1];
+    }
+    return NULL;
 }
 
 /*
     Returns the pointer to the user at the given 
     position if found, or a pointer to null if not.
  */
-User *findUserAtPos(User *list, unsigned int pos) {
-    User *cur = list;
+User *findUserAtPos(UserTable *t, unsigned int pos) {
+    return pos < t->count ? t->list[pos] : NULL;
+}
+
+#define RECORD(_POS) ((MsgRecord*)(msgLog.buf + (_POS)))
+#define RECORD_SIZE(_LEN) (sizeof(MsgRecord) + (_LEN))
+
+// Moves <pos> past the record there, and past the end if that's next
+static uint16 skipRecord(uint16 pos) {
+    if (msgLog.buf[pos] != MSG_WRAP)
+        pos += RECORD_SIZE(RECORD(pos)->len);
+    else
+        pos = MSG_ARENA_SIZE;
+    if (pos >= MSG_ARENA_SIZE || msgLog.buf[pos] == MSG_WRAP)
+        pos = 0;
+    return pos;
+}
+
+// Drops the oldest record in the arena
+static void evictMessage(UserTable *t) {
+    User *u = findUser(t, RECORD(msgLog.tail)->userID, 0);
+    
+    if (u)
+        --u->numMsgs;
+    msgLog.tail = skipRecord(msgLog.tail);
+    --msgLog.numRecords;
+    ++msgLog.numEvicted;
+}
+
+/*
+    Returns where a record of <size> bytes can go once enough of the
+    oldest ones are evicted.
+*/
+static uint16 makeRoom(UserTable *t, uint16 size) {
+    for (;;) {
+        if (!msgLog.numRecords)
+            msgLog.head = msgLog.tail = 0;
+        if (msgLog.head > msgLog.tail || !msgLog.numRecords) {
+            // Free from head to the end, then up to tail at the front
+            if (MSG_ARENA_SIZE - msgLog.head >= size)
+                return msgLog.head;
+            if (msgLog.tail >= size) {
+                msgLog.buf[msgLog.head] = MSG_WRAP;
+                return 0;
+            }
+        }
+        else if (msgLog.head < msgLog.tail && msgLog.tail - msgLog.head >= size)
+            return msgLog.head;
+        evictMessage(t);
+    }
+}
+
+/*
+    Adds a message to the end of the log, as sent to or received from
+    <user>, evicting the oldest messages if there isn't room.
+*/
+void addMessage(UserTable *t, User *user, const char *msg, int sent) {
+    uint8 len = 0;
+    uint16 pos;
+    MsgRecord *r;
+    
+    while (len < MSG_MAX_LEN && msg[len])
+        ++len;
+    pos = makeRoom(t, RECORD_SIZE(len));
+    r = RECORD(pos);
+    r->len = len;
+    r->sent = sent;
+    r->userID = user->uniqueID;
+    memcpy(r->text, msg, len);
+    msgLog.head = pos + RECORD_SIZE(len);
+    if (msgLog.head == MSG_ARENA_SIZE)
+        msgLog.head = 0;
+    ++msgLog.numRecords;
+    ++user->numMsgs;
+}
+
+/*
+    Returns <user>'s next message, oldest first, or NULL after the last.
+    Start with <it> zeroed. The arena mustn't change in between.
+*/
+MsgRecord *nextMessage(User *user, MsgIter *it) {
+    MsgRecord *r;
     
-    while (cur && pos-- > 0) {
-        cur = cur->next;
+    if (!it->started) {
+        it->pos = msgLog.tail;
+        it->left = msgLog.numRecords;
+        it->started = 1;
     }
+    while (it->left) {
+        r = RECORD(it->pos);
+        it->pos = skipRecord(it->pos);
+        --it->left;
+        if (r->userID == user->uniqueID)
+            return r;
+    }
+    return NULL;
+}
+
+// Bytes of the arena in use, including any unused end
+uint16 msgLogUsed() {
+    if (!msgLog.numRecords)
+        return 0;
+    if (msgLog.head > msgLog.tail)
+        return msgLog.head - msgLog.tail;
+    return MSG_ARENA_SIZE - msgLog.tail + msgLog.head;
+}
+
+/*
+    Fills in <p> with where <u> is estimated to be at <now>, moving on
+    from its last position at its last speed and course.
+*/
+void predictUser(User *u, uint32 now, Position *p) {
+    uint32 age = now - u->heardAt;
     
-    return cur;
+    *p = u->pos;
+    if (!p->latDir)
+        return;
+    deadReckon(&p->lat, &p->lon, u->groundSpeed, u->groundCourse,
+               age > DR_MAX_MS ? DR_MAX_MS : age);
+    p->latDir = p->lat < 0 ? 'S' : 'N';
+    p->lonDir = p->lon < 0 ? 'W' : 'E';
 }
 
-void addMessage(User *user, char *msg, int sent) {
-    Message *tmp = calloc(sizeof(Message), 1);
-            
-    // Add the message data
-    strncpy(tmp->msg, msg, 256);
-    tmp->msgLen = strlen(msg);
-    tmp->sent = sent;
+// Whether any user with a position is moving, so their estimate changes
+int usersMoving(UserTable *t) {
+    User *u;
+    int i;
     
-    // Add the message to the end of the list
-    if (user->msgs) {
-        // There are other messages
-        tmp->next = user->msgs;
-        tmp->prev = user->msgs->prev;
-        user->msgs->prev->next = tmp;
-        user->msgs->prev = tmp;
+    for (i = 0; i < t->count; i++) {
+        u = t->list[i];
+        if (u->pos.latDir && u->groundSpeed && msTicks - u->heardAt < DR_MAX_MS)
+            return 1;
     }
-    else {
-        // This is the first message
-        user->msgs = tmp->next = tmp->prev = tmp;
+    return 0;
+}
+
+/*
+    Marks users that have missed USER_STALE_BEACONS as stale, and drops
+    those unheard for USER_EXPIRE_MS. <beaconGap> is the longest users
+    go between beacons. Sets t->changed if anything did.
+*/
+void expireUsers(UserTable *t, uint32 now, uint32 beaconGap) {
+    User *u;
+    uint8 stale;
+    int i;
+    
+    for (i = t->count - 1; i >= 0; i--) {
+        u = t->list[i];
+        if (now - u->lastHeard > USER_EXPIRE_MS && u != t->keep) {
+            dropUser(t, i);
+            continue;
+        }
+        stale = now - u->lastHeard > USER_STALE_BEACONS * beaconGap;
+        if (stale != u->stale) {
+            u->stale = stale;
+            t->changed = 1;
+        }
     }
-    ++user->numMsgs;
-}
\ No newline at end of file
+}
@@ -1,56 +1,134 @@
 #pragma pack(1)
 #include <cytypes.h>
 #include <nmea.h>
+#include "pool.h"
 
 #ifndef __USERS_H
 #define __USERS_H
     
+// Same layout as the lat/lon fields of RMC_Str
 typedef struct Position {
-    float64 lat;
+    int32  lat; // 1e-7 degrees, negative for S
     char   latDir; // N/S
-    float64 lon;
+    int32  lon; // 1e-7 degrees, negative for W
     char   lonDir; // E/W
 } Position;
 
-typedef struct Message {
-    uint8 msgLen;
-    char  msg[255];
-    uint8 sent;
-    struct Message *next;
-    struct Message *prev;
-} Message;
+#define MSG_MAX_LEN 254 // Longest message text
+
+#define MSG_ARENA_SIZE 4096 // Bytes of message history, for all users
+#define MSG_WRAP 0xFF // In place of a record's len, the rest of the arena is unused
+
+// A message in the arena, followed by its text
+typedef struct MsgRecord {
+    uint8  len; // Of the text, which isn't terminated
+    uint8  sent;
+    uint32 userID; // uID of who it was sent to or received from
+    char   text[];
+} MsgRecord;
+
+/*
+    Every user's messages, as variable length records in one ring of
+    bytes, oldest first. A record never wraps around the end of the
+    arena; one that doesn't fit before it starts over at the front. When
+    the arena is full the oldest records make room for new ones.
+*/
+typedef struct MsgLog {
+    uint8  buf[MSG_ARENA_SIZE];
+    uint16 head; // Where the next record goes
+    uint16 tail; // Oldest record
+    uint16 numRecords;
+    uint16 numEvicted;
+} MsgLog;
+
+MsgLog msgLog;
+
+// Walks the arena, see nextMessage
+typedef struct MsgIter {
+    uint16 pos;
+    uint16 left; // Records not yet visited
+    uint8  started;
+} MsgIter;
+
+// The message being composed
+typedef struct Draft {
+    uint32 to; // uID of the user it's for
+    uint8  msgLen;
+    char   msg[MSG_MAX_LEN + 1];
+} Draft;
 
 typedef struct User {
     uint32      uniqueID;
+    uint16      shortID; // Identifies the user's beacons
     char        name[20];
-    float64      utc;
+    uint32      utc; // Milliseconds since midnight
     Position    pos;
-    float       pdop;
+    uint16      pdop; // Hundredths
     /* To be implemented later
     Position    dest;
     float64      alt;
     char        altUnits;
     */
-    float       groundSpeed; // In knots
-    float       groundCourse; // In degrees
-    uint8       numMsgs;
-    Message     *msgs;
-    Message     tempMsg;
-    struct User *next;
+    uint16      groundSpeed; // In centi-knots
+    uint16      groundCourse; // In centi-degrees
+    uint32      heardAt; // msTicks when pos was received
+    uint32      lastHeard; // msTicks of the last frame from the user, of any kind
+    uint8       stale; // Missed USER_STALE_BEACONS, so pos is out of date
+    uint8       addr[8]; // 64-bit address of the user's XBee, 0 until heard in API mode
+    uint8       rssi; // -dBm of the last packet heard from the user
+    uint16      numDelivered; // Our frames the user's radio acknowledged
+    uint16      numFailed; // Our frames that weren't
+    uint16      numMsgs; // Records in msgLog
 } User;
 
+#define MAX_USERS 30
+#define USER_STALE_BEACONS 3 // Beacons missed before a user is shown as stale
+#define USER_EXPIRE_MS (10 * 60000UL) // Unheard this long and a user is dropped
+#define USER_HASH_BITS 6 // At least twice MAX_USERS slots, to keep probes short
+#define USER_HASH_SIZE (1 << USER_HASH_BITS)
+
+// Short ID a user goes by in beacons
+#define SHORT_ID(_ID) (((_ID) ^ ((_ID) >> 16)) & 0xFFFF)
+
+/*
+    Users we have seen on the network, in the order they were first
+    heard, which is the order they are listed in. Open-addressing
+    indexes on uID and short ID, with linear probing, find a user in
+    the list without walking it. Users that go unheard for
+    USER_EXPIRE_MS are dropped, as is the least recently heard one when
+    a new user needs room.
+*/
+typedef struct UserTable {
+    User  *list[MAX_USERS];
+    uint8 count;
+    uint8 byID[USER_HASH_SIZE]; // Position in list + 1, 0 if empty
+    uint8 byShortID[USER_HASH_SIZE];
+    User  *keep; // Never dropped, e.g. while it's on screen
+    uint8 changed; // Users were added, dropped or went stale since cleared
+    uint16 numDropped;
+} UserTable;
+
+// Users come from here, never the heap
+extern Pool userPool;
+
 typedef struct Self {
     char    name[20];
     uint32  id;
-    GGA_Str gga;
-    GSA_Str gsa;
-    GSV_Str gsv;
-    RMC_Str rmc;
-    VTG_Str vtg;
-    User *users; // Users we have seen on the network
+    NAV_Assembler nav; // Our own position, time and velocity
+    GSV_Assembler gsv;
+    UserTable users;
+    Draft   draft;
 } Self;
 
-User *findUser(User **list, uint64 id, int createNew);
-User *findUserAtPos(User *list, unsigned int pos);
-void addMessage(User *user, char *msg, int sent);
+#define DR_MAX_MS 60000 // Longest a user's position is extrapolated for
+
+User *findUser(UserTable *t, uint32 id, int createNew);
+User *findUserAtPos(UserTable *t, unsigned int pos);
+User *findUserByShortID(UserTable *t, uint16 shortID);
+void addMessage(UserTable *t, User *user, const char *msg, int sent);
+MsgRecord *nextMessage(User *user, MsgIter *it);
+uint16 msgLogUsed();
+void predictUser(User *u, uint32 now, Position *p);
+int  usersMoving(UserTable *t);
+void expireUsers(UserTable *t, uint32 now, uint32 beaconGap);
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "xbapi.h"
+
+// Address to send to when the destination's isn't known
+static const uint8 broadcastAddr[8] = {0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+
+/*
+    Feeds one received byte to the framer. Returns a pointer to the
+    finished frame when <c> completes one with a good checksum,
+    otherwise NULL. The caller must point fr->f at a new buffer before
+    the next byte if it wants to keep the returned frame. With escaping
+    on, a start byte always starts a new frame.
+*/
+XBAPI_Frame *XBAPI_Feed(XBAPI_Framer *fr, uint8 c) {
+    XBAPI_Frame *f = fr->f;
+
+#if XB_API_MODE == 2
+    if (c == XBAPI_START) {
+        fr->escaped = 0;
+        fr->state = XBAPI_LEN_HI;
+        return NULL;
+    }
+    if (c == XBAPI_ESCAPE) {
+        fr->escaped = 1;
+        return NULL;
+    }
+    if (fr->escaped) {
+        c ^= 0x20;
+        fr->escaped = 0;
+    }
+#endif
+
+    switch (fr->state) {
+        case XBAPI_HUNT:
+            if (c == XBAPI_START)
+                fr->state = XBAPI_LEN_HI;
+            break;
+        case XBAPI_LEN_HI:
+            f->len = c << 8;
+            fr->state = XBAPI_LEN_LO;
+            break;
+        case XBAPI_LEN_LO:
+            f->len |= c;
+            fr->pos = 0;
+            fr->sum = 0;
+            fr->state = XBAPI_DATA;
+            if (!f->len || f->len > XBAPI_MAX_DATA) {
+                ++fr->numTooLong;
+                fr->state = XBAPI_HUNT;
+            }
+            break;
+        case XBAPI_DATA:
+            f->data[fr->pos++] = c;
+            fr->sum += c;
+            if (fr->pos == f->len)
+                fr->state = XBAPI_CHECKSUM;
+            break;
+        case XBAPI_CHECKSUM:
+            fr->state = XBAPI_HUNT;
+            if ((uint8)(fr->sum + c) == 0xFF)
+                return f;
+            ++fr->numBadChecksum;
+            break;
+    }
+
+    return NULL;
+}
+
+#if XB_API_MODE == 2
+// Writes <c> to <out>, escaped if it has to be. Returns the bytes written.
+static uint16 putEscaped(uint8 *out, uint8 c) {
+    if (c == XBAPI_START || c == XBAPI_ESCAPE || c == 0x11 || c == 0x13) {
+        out[0] = XBAPI_ESCAPE;
+        out[1] = c ^ 0x20;
+        return 2;
+    }
+    out[0] = c;
+    return 1;
+}
+#else
+static uint16 putEscaped(uint8 *out, uint8 c) {
+    out[0] = c;
+    return 1;
+}
+#endif
+
+/*
+    Wraps <len> bytes of frame data in an API frame. <out> needs room
+    for len + XBAPI_OVERHEAD bytes, or twice that with escaping.
+    Returns the length of the frame.
+*/
+uint16 XBAPI_Encode(uint8 *out, const uint8 *data, uint16 len) {
+    uint16 n = 1, i;
+    uint8 sum = 0;
+
+    out[0] = XBAPI_START;
+    n += putEscaped(out + n, len >> 8);
+    n += putEscaped(out + n, len & 0xFF);
+    for (i = 0; i < len; i++) {
+        n += putEscaped(out + n, data[i]);
+        sum += data[i];
+    }
+    n += putEscaped(out + n, 0xFF - sum);
+
+    return n;
+}
+
+/*
+    Builds a transmit request for <len> bytes of RF data to the radio
+    with 64-bit address <dest>, or broadcast if it is NULL. A frameId of
+    0 asks for no transmit status. Returns the length of the frame.
+*/
+uint16 XBAPI_TxRequest(uint8 *out, uint8 frameId, const uint8 *dest,
+ const uint8 *rf, uint16 len) {
+    uint8 data[XBAPI_TX_HEADER + XBAPI_MAX_RF];
+
+    data[0] = XBAPI_TX_REQUEST;
+    data[1] = frameId;
+    memcpy(data + 2, dest ? dest : broadcastAddr, 8);
+    data[10] = 0xFF; // 16-bit address unknown
+    data[11] = 0xFE;
+    data[12] = 0; // Maximum hops
+    data[13] = 0; // Options
+    memcpy(data + XBAPI_TX_HEADER, rf, len);
+
+    return XBAPI_Encode(out, data, XBAPI_TX_HEADER + len);
+}
+
+// Builds a query of the two letter AT command <cmd>
+uint16 XBAPI_AtCommand(uint8 *out, uint8 frameId, const char *cmd) {
+    uint8 data[4] = {XBAPI_AT_COMMAND, frameId, cmd[0], cmd[1]};
+
+    return XBAPI_Encode(out, data, 4);
+}
+
+// Builds a command setting the two letter AT parameter <cmd> to <value>
+uint16 XBAPI_AtSet(uint8 *out, uint8 frameId, const char *cmd, uint8 value) {
+    uint8 data[5] = {XBAPI_AT_COMMAND, frameId, cmd[0], cmd[1], value};
+
+    return XBAPI_Encode(out, data, 5);
+}
@@ -0,0 +1,62 @@
+#pragma pack(1)
+
+#ifndef __XBAPI_H
+#define __XBAPI_H
+
+#include <cytypes.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+    Serial mode the XBee is configured for (its AP setting):
+    0 = transparent, 1 = API, 2 = API with escaped bytes.
+    In transparent mode the link frames go out as a plain byte stream.
+    In the API modes XB_ConfigureApi sets the radio to match at startup.
+*/
+#ifndef XB_API_MODE
+#define XB_API_MODE 1
+#endif
+
+#define XBAPI_START  0x7E
+#define XBAPI_ESCAPE 0x7D
+
+// API frame types
+#define XBAPI_AT_COMMAND  0x08
+#define XBAPI_TX_REQUEST  0x10
+#define XBAPI_AT_RESPONSE 0x88
+#define XBAPI_TX_STATUS   0x8B
+#define XBAPI_RX_PACKET   0x90
+
+#define XBAPI_MAX_RF     100 // Most RF data per transmit request (the radio's NP)
+#define XBAPI_TX_HEADER  14  // Transmit request fields before the RF data
+#define XBAPI_RX_HEADER  12  // Receive packet fields before the RF data
+#define XBAPI_MAX_DATA   (XBAPI_RX_HEADER + XBAPI_MAX_RF)
+#define XBAPI_OVERHEAD   4   // Start, length and checksum
+
+// A received API frame, starting with its type
+typedef struct XBAPI_Frame {
+    uint16 len;
+    uint8  data[XBAPI_MAX_DATA];
+} XBAPI_Frame;
+
+typedef enum {XBAPI_HUNT, XBAPI_LEN_HI, XBAPI_LEN_LO, XBAPI_DATA,
+    XBAPI_CHECKSUM} xbapi_state;
+
+// Incremental API frame receiver, fed one byte at a time
+typedef struct XBAPI_Framer {
+    XBAPI_Frame *f;
+    xbapi_state state;
+    uint16 pos;
+    uint8  sum; // Of the frame data so far
+    uint8  escaped; // The last byte was XBAPI_ESCAPE
+    uint16 numBadChecksum;
+    uint16 numTooLong;
+} XBAPI_Framer;
+
+XBAPI_Frame *XBAPI_Feed(XBAPI_Framer *fr, uint8 c);
+uint16 XBAPI_Encode(uint8 *out, const uint8 *data, uint16 len);
+uint16 XBAPI_TxRequest(uint8 *out, uint8 frameId, const uint8 *dest,
+ const uint8 *rf, uint16 len);
+uint16 XBAPI_AtCommand(uint8 *out, uint8 frameId, const char *cmd);
+uint16 XBAPI_AtSet(uint8 *out, uint8 frameId, const char *cmd, uint8 value);
+#endif
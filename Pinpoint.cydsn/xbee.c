@@ -1,81 +1,840 @@
 #include <xbee.h>
+#include "tick.h"
+
+static void sendProbe(Self *me, uint16 id);
+static char *reassemble(XBEE_Header *hdr, uint16 n);
+static void slotHeard(Self *me, XBEE_Beacon *b);
+static int  seenFrame(XBEE_Relay *r);
+static void queueRelay(XBL_Frame *f);
+#if XB_API_MODE
+static void queryRssi(User *u);
+#endif
+
+static uint8 beaconsSinceAnnounce = XB_ANNOUNCE_EVERY; // Announce straight away
+static uint32 lastProbe;
+
+// Short ID used for <uniqueID> in beacons
+uint16 shortID(uint32 uniqueID) {
+    return SHORT_ID(uniqueID);
+}
+
+// Updates the user's position from a beacon
+static void logBeacon(User *u, XBEE_Beacon *b) {
+    uint32 tow = b->tow[0] | (b->tow[1] << 8) | ((uint32)b->tow[2] << 16);
+    
+    u->utc = tow * 100 % 86400000UL;
+    u->heardAt = msTicks;
+    u->groundSpeed = XB_SPEED_CK(b->speed);
+    u->groundCourse = XB_COURSE_CD(b->course);
+    if (b->lat == XB_NO_FIX) {
+        u->pos.latDir = u->pos.lonDir = 0;
+    }
+    else {
+        u->pos.lat = b->lat;
+        u->pos.latDir = b->lat < 0 ? 'S' : 'N';
+        u->pos.lon = b->lon;
+        u->pos.lonDir = b->lon < 0 ? 'W' : 'E';
+    }
+    if (curMenu == MENU_HOME)
+       Disp_Refresh_Map();
+}
+
+// Whether every fragment of <r> is in
+static int reasmDone(XB_Reassembly *r) {
+    return r->have == (1 << r->count) - 1;
+}
+
+/*
+    Files the <n> bytes of text in message fragment <hdr> with the rest
+    of its message. Returns the whole text once the last missing
+    fragment is in, and NULL until then. Repeats of a completed message
+    are ignored while its slot is kept. A message still missing
+    fragments after XB_REASM_TIMEOUT is given up on when its slot is
+    needed.
+*/
+static char *reassemble(XBEE_Header *hdr, uint16 n) {
+    XB_Reassembly *r = NULL;
+    uint8 index = hdr->frag >> 4;
+    uint8 count = (hdr->frag & 0x0F) + 1;
+    int i, found = 0, stale;
+    
+    if (count > XB_MAX_FRAGS || index >= count
+        || (index < count - 1 && n != XB_FRAG_DATA)
+        || index * XB_FRAG_DATA + n > MSG_MAX_LEN) // e.g. a longer MSG_MAX_LEN
+        return NULL;
+    
+    for (i = 0; i < XB_REASM_SLOTS && !found; i++) {
+        if (xbRx.slot[i].count && xbRx.slot[i].srcID == hdr->srcID
+            && xbRx.slot[i].msgID == hdr->msgID)
+            found = 1;
+        else if (r)
+            continue;
+        else if (xbRx.slot[i].count && !reasmDone(&xbRx.slot[i])
+                 && msTicks - xbRx.slot[i].started <= XB_REASM_TIMEOUT)
+            continue; // Still waiting on fragments
+        r = &xbRx.slot[i];
+    }
+    if (!r)
+        return NULL; // Busy with other messages
+    
+    stale = msTicks - r->started > XB_REASM_TIMEOUT;
+    if (found && reasmDone(r) && !stale)
+        return NULL; // A repeat
+    if (!found || stale || r->count != count) {
+        if (r->count && !reasmDone(r))
+            ++xbRx.numTimedOut;
+        r->srcID = hdr->srcID;
+        r->msgID = hdr->msgID;
+        r->count = count;
+        r->have = 0;
+        r->started = msTicks;
+    }
+    
+    memcpy(r->text + index * XB_FRAG_DATA, hdr + 1, n);
+    if (index == count - 1)
+        r->len = index * XB_FRAG_DATA + n;
+    if ((r->have |= 1 << index) == (1 << count) - 1) {
+        r->text[r->len] = '\0';
+        return r->text;
+    }
+    return NULL;
+}
 
 /*
     Parses the message and enacts the appropriate action depending
     on the type of data in the message.
 */
-void logXBdata(Self *me, void *data) {
-    XBEE_Header *hdr = data;
-    User *u = findUser(&me->users, hdr->srcID, 1);
+void logXBdata(Self *me, XBL_Frame *f) {
+    XBEE_Relay *rl = (XBEE_Relay*)f->data;
+    XBEE_Header *hdr = (XBEE_Header*)(rl + 1);
+    XBEE_Announce *ann = (XBEE_Announce*)(rl + 1);
+    XBEE_Beacon *b = (XBEE_Beacon*)(rl + 1);
+    XBEE_Probe *probe = (XBEE_Probe*)(rl + 1);
+    int direct = rl->ttl == XB_RELAY_HOPS; // Heard from the origin itself
+    int seen;
+    User *u;
     
-    /* Copy the name */
-    memcpy(u->name, hdr->name, 20);
+    // Our own frames come back from relays
+    if (rl->origin == shortID(me->id) || (seen = seenFrame(rl)) == 1)
+        return;
+    // Pass it on, unless it was only for us
+    if (rl->ttl > 1 && !(f->type == MESSAGE && hdr->destID == me->id)
+        && !(f->type == PROBE_REQ && probe->shortID == shortID(me->id)))
+        queueRelay(f);
+    if (seen)
+        return; // A copy that can go further, handled already
     
-    if (hdr->type == POSITION) {
-        XBEE_Position *pos = (XBEE_Position*)(hdr + 1);
-        // Update the position
-        u->utc = pos->utc;
-        u->pos = pos->pos;
-        if (curMenu == MENU_HOME)
-           Disp_Refresh_Map();
+    switch (f->type) {
+        case PROBE_REQ:
+            if (probe->shortID == shortID(me->id)) {
+                beaconsSinceAnnounce = XB_ANNOUNCE_EVERY;
+                xbBeacon.force = 1;
+            }
+            return;
+        case POSITION:
+            if (direct)
+                slotHeard(me, b);
+            if (!(u = findUserByShortID(&me->users, b->shortID))) {
+                // Someone we haven't had an announce from yet
+                sendProbe(me, b->shortID);
+                return;
+            }
+            logBeacon(u, b);
+            break;
+        case ANNOUNCE:
+            if (direct)
+                slotHeard(me, &ann->beacon);
+            if (!(u = findUser(&me->users, ann->uniqueID, 1)))
+                return; // No room
+            memcpy(u->name, ann->name, 20);
+            logBeacon(u, &ann->beacon);
+            break;
+        case MESSAGE: {
+            char *text;
+            
+            if (hdr->destID && hdr->destID != me->id)
+                return; // Only relaying it
+            text = reassemble(hdr, f->len - sizeof(XBEE_Relay) - sizeof(XBEE_Header));
+            if (!(u = findUser(&me->users, hdr->srcID, 1)))
+                return;
+            if (!u->name[0]) // Haven't had an announce from them yet
+                sendProbe(me, u->shortID);
+            if (!text)
+                break;
+            // Add the message to the user's list
+            addMessage(&me->users, u, text, 0);
+            Adafruit_RA8875_textMode();
+            Adafruit_RA8875_textEnlarge(2);
+            Adafruit_RA8875_textSetCursor(170, 100);
+            Adafruit_RA8875_textColor(RA8875_RED, RA8875_BLACK);
+            Adafruit_RA8875_textWrite("New Message", 11);
+            break;
+        }
+        default:
+            return;
     }
-    else if (hdr->type == MESSAGE) {
-        XBEE_Message *msg = (XBEE_Message*)(hdr + 1);
-        // Add the message to the user's list
-        addMessage(u, msg->msg, 0);
-        Adafruit_RA8875_textMode();
-        Adafruit_RA8875_textEnlarge(2);
-        Adafruit_RA8875_textSetCursor(170, 100);
-        Adafruit_RA8875_textColor(RA8875_RED, RA8875_BLACK);
-        Adafruit_RA8875_textWrite("New Message", 11);
+    u->lastHeard = msTicks;
+    
+#if XB_API_MODE
+    // Remember the user's radio so we can unicast to it, and find out
+    // how well we heard it. Relayed frames come from the relay's radio.
+    if (direct) {
+        memcpy(u->addr, f->src, 8);
+        queryRssi(u);
+    }
+#endif
+}
+
+// Link frame being built, only used from the main loop
+static uint8 linkBuf[XB_FRAME_MAX];
+
+// Where the payload of the next frame goes, before sealFrame encodes it
+#define RELAY_HDR ((XBEE_Relay*)(linkBuf + 4))
+#define PAYLOAD ((void*)(RELAY_HDR + 1))
+
+/*
+    Fills in the header of the next message fragment and returns where
+    its text goes.
+*/
+static void *buildFrame(Self *me, uint32 destID, uint8 msgID, uint8 index, uint8 count) {
+    XBEE_Header *hdr = (XBEE_Header*)PAYLOAD;
+    
+    hdr->destID = destID;
+    hdr->srcID = me->id;
+    hdr->msgID = msgID;
+    hdr->frag = index << 4 | (count - 1);
+    
+    return hdr + 1;
+}
+
+#if XB_API_MODE
+/*
+    Takes the next of the <count> API frame IDs after <base>, <last>
+    being the one taken before, and remembers which user its reply is
+    about.
+*/
+static uint8 newFrameId(uint8 *last, uint8 base, uint8 count, uint32 owner) {
+    *last = *last % count + 1;
+    xbTx.idOwner[base + *last - 1] = owner;
+    return base + *last;
+}
+#define newTxId(_owner) newFrameId(&xbTx.lastTxId, 0, XB_TX_IDS, _owner)
+#define newAtId(_owner) newFrameId(&xbTx.lastAtId, XB_TX_IDS, XB_AT_IDS, _owner)
+
+// Whether we've heard from <u> in API mode and know its radio's address
+static int hasAddr(User *u) {
+    static const uint8 none[8] = {0};
+    
+    return memcmp(u->addr, none, 8) != 0;
+}
+#endif
+
+/*
+    Adds the link framing around the <size> byte payload, relay header
+    and all, and puts the result in <f>, ready to send. In API mode it is
+    split over as many transmit requests as it takes, addressed to
+    <dest> if its radio is known and broadcast otherwise. Only the last
+    one asks for a transmit status, which is counted against <dest>.
+*/
+static void encodeFrame(XB_Frame *f, uint8 type, uint16 size, User *dest) {
+    uint16 len = XBL_Encode(linkBuf, type, linkBuf + 4, size);
+#if XB_API_MODE
+    const uint8 *addr = dest && hasAddr(dest) ? dest->addr : NULL;
+    uint16 i, n;
+    
+    for (i = 0, f->len = 0; i < len; i += n) {
+        n = len - i > XBAPI_MAX_RF ? XBAPI_MAX_RF : len - i;
+        f->len += XBAPI_TxRequest(f->data + f->len,
+         i + n == len && dest ? newTxId(dest->uniqueID) : 0, addr, linkBuf + i, n);
     }
+#else
+    memcpy(f->data, linkBuf, len);
+    f->len = len;
+#endif
 }
 
+// Sends the <size> byte payload as a frame of our own, see encodeFrame
+static void sealFrame(Self *me, XB_Frame *f, XB_Payload_Type type, uint16 size, User *dest) {
+    RELAY_HDR->origin = shortID(me->id);
+    RELAY_HDR->seq = ++xbRelay.seq;
+    RELAY_HDR->ttl = XB_RELAY_HOPS;
+    encodeFrame(f, type, sizeof(XBEE_Relay) + size, dest);
+}
+
+// Slot <salt> in the sequence of slots <id> tries
+static uint8 pickSlot(uint32 id, uint8 salt) {
+    uint32 h = (id ^ salt * 0x9E3779B9UL) * 2654435761UL; // Wraps at 32 bits everywhere
+    
+    return (h >> 16) % XB_NUM_SLOTS;
+}
+
+// Picks our first slot, with none heard from anyone yet
+void XB_BeaconInit(Self *me) {
+    int i;
+    
+    memset(&xbBeacon, 0, sizeof(xbBeacon));
+    xbBeacon.slot = pickSlot(me->id, 0);
+    for (i = 0; i < XB_NUM_SLOTS; i++)
+        xbBeacon.slotHeardAt[i] = msTicks - XB_SLOT_MEMORY;
+}
+
+/*
+    Notes the slot of a beacon we heard. If it is ours, whichever of us
+    has the higher short ID moves to the next slot in its sequence that
+    nobody has been heard in lately.
+*/
+static void slotHeard(Self *me, XBEE_Beacon *b) {
+    int i;
+    
+    if (b->slot >= XB_NUM_SLOTS)
+        return;
+    xbBeacon.slotHeardAt[b->slot] = msTicks;
+    if (b->slot != xbBeacon.slot || b->shortID >= shortID(me->id))
+        return;
+    
+    ++xbBeacon.numCollisions;
+    for (i = 0; i < XB_NUM_SLOTS; i++) {
+        xbBeacon.slot = pickSlot(me->id, ++xbBeacon.salt);
+        if (msTicks - xbBeacon.slotHeardAt[xbBeacon.slot] >= XB_SLOT_MEMORY)
+            break;
+    }
+}
+
+/*
+    Runs the same dead reckoning receivers do on our last beacon, and
+    returns 1 if its estimate has drifted more than XB_DR_ERROR from our
+    actual position, the fix has come or gone, or it is time for a
+    keep-alive.
+*/
+static int needBeacon(Self *me, uint32 now) {
+    NAV_Solution nav;
+    int32 lat, lon;
+    
+    if (xbBeacon.force || !xbBeacon.numSent || now - xbBeacon.sentAt >= XB_KEEPALIVE)
+        return 1;
+    
+    readNav(&me->nav, &nav);
+    if (!nav.latDir != !xbBeacon.fix)
+        return 1;
+    if (nav.latDir) {
+        lat = xbBeacon.lat;
+        lon = xbBeacon.lon;
+        deadReckon(&lat, &lon, xbBeacon.groundSpeed, xbBeacon.groundCourse,
+                   now - xbBeacon.sentAt);
+        if (distance(nav.lat, nav.lon, lat, lon, NULL, NULL) > XB_DR_ERROR)
+            return 1;
+    }
+    ++xbBeacon.numSkipped;
+    return 0;
+}
+
+// Whether GPS time at <now> is early enough in our slot to start a beacon
+static int inSlot(uint32 now) {
+    uint32 utc, pos;
+    
+    if (!GPS_Time(now, &utc))
+        return 1; // No common time base, send straight away
+    pos = utc % XB_SUPERFRAME;
+    return pos / XB_SLOT_MS == xbBeacon.slot
+           && pos % XB_SLOT_MS < XB_SLOT_MS - XB_SLOT_GUARD;
+}
+
+/*
+    Returns 1 when broadcastPosition should be called. Whether a beacon
+    is needed is checked at most once per XB_Rate period, so a moving
+    user's beacons go out at up to that rate and a stationary one's
+    every XB_KEEPALIVE. One that is needed waits for our slot.
+    <now> is in milliseconds.
+*/
+int XB_BeaconDue(Self *me, uint32 now) {
+    if (!xbBeacon.pending && now - xbBeacon.lastCheck >= xbRatePeriod[XB_Rate]) {
+        xbBeacon.lastCheck = now;
+        xbBeacon.pending = needBeacon(me, now);
+    }
+    return xbBeacon.pending && inSlot(now);
+}
+
+/*
+    Sends a position beacon, or every XB_ANNOUNCE_EVERY periods (and
+    when someone has probed for us) an announce with our uID and name.
+*/
 void broadcastPosition(Self *me) {
-    XBEE_Header hdr;
-    XBEE_Position pos;
+    XBEE_Announce *ann = PAYLOAD;
+    XB_Payload_Type type = POSITION;
+    NAV_Solution nav;
+    uint32 tow, utc;
+    uint8 intState;
     
-    // Clear out the timer interrupt
-    Broadcast_Timer_ReadStatusRegister();
+    readNav(&me->nav, &nav);
     
-    // Fill in the header
-    hdr.destID = 0;
-    memcpy(hdr.name, me->name, 20);
-    hdr.srcID = me->id;
-    hdr.type = POSITION;
+    tow = timeOfWeek(nav.date, nav.utc) / 100;
+    ann->beacon.shortID = shortID(me->id);
+    ann->beacon.tow[0] = tow;
+    ann->beacon.tow[1] = tow >> 8;
+    ann->beacon.tow[2] = tow >> 16;
+    ann->beacon.lat = nav.latDir ? nav.lat : XB_NO_FIX;
+    ann->beacon.lon = nav.lon;
+    ann->beacon.speed = XB_SPEED(nav.groundSpeed);
+    ann->beacon.course = XB_COURSE(nav.groundCourse);
+    ann->beacon.slot = GPS_Time(msTicks, &utc) ? xbBeacon.slot : XB_NUM_SLOTS;
+    if (beaconsSinceAnnounce + 1 >= XB_ANNOUNCE_EVERY) {
+        type = ANNOUNCE;
+        ann->uniqueID = me->id;
+        memcpy(ann->name, me->name, 20);
+    }
     
-    // Fill in the position
-    pos.utc = me->rmc.utc;
-    memcpy(&pos.pos, &me->rmc.lat, sizeof(Position));
+    // The beacon slot may be being sent, so it is only touched with
+    // the TX interrupt held off
+    intState = CyEnterCriticalSection();
+    if (xbTx.cur == &xbTx.beacon) {
+        // Still going out, so this one stays pending and is tried
+        // again while our slot lasts
+        CyExitCriticalSection(intState);
+        return;
+    }
+    if (xbTx.beaconReady)
+        ++xbTx.numBeaconsReplaced;
+    sealFrame(me, &xbTx.beacon, type, XBEE_STR_SIZE[type], NULL);
+    xbTx.beaconReady = 1;
+    CyExitCriticalSection(intState);
+    
+    // Queued, so remember what receivers will extrapolate from
+    xbBeacon.sentAt = msTicks;
+    xbBeacon.lat = nav.lat;
+    xbBeacon.lon = nav.lon;
+    xbBeacon.groundSpeed = XB_SPEED_CK(ann->beacon.speed);
+    xbBeacon.groundCourse = XB_COURSE_CD(ann->beacon.course);
+    xbBeacon.fix = nav.latDir != 0;
+    xbBeacon.force = 0;
+    xbBeacon.pending = 0;
+    ++xbBeacon.numSent;
+    beaconsSinceAnnounce = type == ANNOUNCE ? 0 : beaconsSinceAnnounce + 1;
+    
+    XB_TxPump();
+}
+
+/*
+    Returns the slot after the last message, where the next one is
+    sealed. The TX interrupt moves msgHead and msgCount as frames go
+    out, so they are read together with it held off. It doesn't touch
+    the slot itself until msgQueued.
+*/
+static XB_Frame *msgTail() {
+    uint8 intState = CyEnterCriticalSection();
+    XB_Frame *f = &xbTx.msg[(xbTx.msgHead + xbTx.msgCount) % XB_TX_MSGS];
     
-    // Send the data
-    XB_PutArray((uint8*)&hdr, sizeof(XBEE_Header));
-    XB_PutArray((uint8*)&pos, sizeof(XBEE_Position));
-    XB_PutArray((uint8*)"***", 3);
+    CyExitCriticalSection(intState);
+    return f;
 }
 
-void sendMessage(Self *me, User *dest){
-    XBEE_Header hdr;
-    XBEE_Message msg;
+// The slot after the last message has been sealed, hand it to the TX
+// interrupt, which frees slots from under msgCount as they go out
+static void msgQueued() {
+    uint8 intState = CyEnterCriticalSection();
+    
+    if (++xbTx.msgCount > xbTx.maxDepth)
+        xbTx.maxDepth = xbTx.msgCount;
+    CyExitCriticalSection(intState);
+}
+
+/*
+    Queues the composed message for <dest>, in as many fragments as its
+    length takes. Returns 0 if the TX queue can't take them all, in
+    which case the message is kept in the draft to be sent again.
+*/
+int sendMessage(Self *me, User *dest){
+    static uint8 msgID;
+    Draft *m = &me->draft;
+    uint8 count = m->msgLen ? (m->msgLen + XB_FRAG_DATA - 1) / XB_FRAG_DATA : 1;
+    uint8 i, n;
+    
+    if (XB_TX_MSGS - xbTx.msgCount < count) {
+        ++xbTx.numMsgDropped;
+        return 0;
+    }
+    ++msgID;
+    for (i = 0; i < count; i++) {
+        n = i < count - 1 ? XB_FRAG_DATA : m->msgLen - i * XB_FRAG_DATA;
+        memcpy(buildFrame(me, dest->uniqueID, msgID, i, count),
+               m->msg + i * XB_FRAG_DATA, n);
+        sealFrame(me, msgTail(), MESSAGE, sizeof(XBEE_Header) + n, dest);
+        msgQueued();
+    }
     
     // Add the message to the user's list
-    addMessage(dest, dest->tempMsg.msg, 1);
+    addMessage(&me->users, dest, m->msg, 1);
+    
+    XB_TxPump();
+    
+    // Clear out the draft
+    m->msgLen = 0;
+    m->msg[0] = 0;
+    
+    return 1;
+}
+
+/*
+    Asks whoever has <id> to announce themselves. Goes in the message
+    queue so it isn't held up behind beacons, at most once every
+    XB_PROBE_GAP ms.
+*/
+static void sendProbe(Self *me, uint16 id) {
+    XBEE_Probe *probe = PAYLOAD;
+    
+    if (msTicks - lastProbe < XB_PROBE_GAP || xbTx.msgCount == XB_TX_MSGS)
+        return;
+    lastProbe = msTicks;
+    probe->shortID = id;
+    sealFrame(me, msgTail(), PROBE_REQ, sizeof(XBEE_Probe), NULL);
+    msgQueued();
+    XB_TxPump();
+}
+
+/*
+    Remembers that the frame starting with <r> has been handled.
+    Returns 1 if it already had, and counts the copy against a relay of
+    it that is still waiting if it has as many hops left. Each origin
+    keeps its highest seq and a bit for each of the 31 before it, and
+    anything older than that is taken as a stale copy. An origin not heard from in XB_SEEN_TIMEOUT
+    starts afresh, as after a reboot. A new origin takes the place of
+    the one heard from longest ago when the table is full.
+
+    Relays go out in slot order rather than hop order, so the first
+    copy heard may have come the long way round. A later copy of the
+    highest seq with more hops left raises the relay still waiting to
+    match, or if there is none returns 2, to be relayed but not handled
+    again.
+*/
+static int seenFrame(XBEE_Relay *r) {
+    XB_Seen *s = NULL, *oldest = xbRelay.seen;
+    uint8 back;
+    int i;
+    
+    for (i = 0; i < xbRelay.numSeen; i++) {
+        s = &xbRelay.seen[i];
+        if (s->origin == r->origin)
+            break;
+        if (msTicks - s->heardAt > msTicks - oldest->heardAt)
+            oldest = s;
+    }
+    if (i == xbRelay.numSeen) {
+        s = i < XB_SEEN_ORIGINS ? &xbRelay.seen[xbRelay.numSeen++] : oldest;
+        s->origin = r->origin;
+        s->heardAt = msTicks - XB_SEEN_TIMEOUT - 1;
+    }
+    
+    back = s->top - r->seq; // Wraps at 8 bits
+    if (msTicks - s->heardAt > XB_SEEN_TIMEOUT) {
+        s->top = r->seq;
+        s->topTtl = r->ttl;
+        s->recent = 1;
+    }
+    else if (back < 0x80) {
+        // The newest or before it
+        if (back >= 32 || s->recent >> back & 1) {
+            int waiting = 0;
+            
+            for (i = 0; i < XB_RELAY_PENDING; i++) {
+                XBEE_Relay *p = (XBEE_Relay*)xbRelay.pending[i].data;
+                if (xbRelay.pending[i].len && p->origin == r->origin && p->seq == r->seq) {
+                    if (p->ttl < r->ttl - 1)
+                        p->ttl = r->ttl - 1;
+                    if (r->ttl >= p->ttl) // Goes as far as ours would
+                        ++xbRelay.pending[i].dups;
+                    waiting = 1;
+                }
+            }
+            if (back || r->ttl <= s->topTtl)
+                return 1;
+            s->topTtl = r->ttl;
+            return waiting ? 1 : 2;
+        }
+        s->recent |= 1UL << back;
+    }
+    else {
+        back = -back; // Now how far ahead
+        s->recent = back < 32 ? s->recent << back | 1 : 1;
+        s->top = r->seq;
+        s->topTtl = r->ttl;
+    }
+    s->heardAt = msTicks;
+    return 0;
+}
+
+/*
+    Holds <f> back to be relayed in our slot, once other relays have
+    had XB_RELAY_BACKOFF_MIN to be heard, or without GPS time after a
+    random back-off.
+*/
+static void queueRelay(XBL_Frame *f) {
+    XB_Relayed *p;
+    uint32 utc;
+    int i;
+    
+    for (i = 0; i < XB_RELAY_PENDING && xbRelay.pending[i].len; i++)
+        ;
+    if (i == XB_RELAY_PENDING) {
+        ++xbRelay.numDropped;
+        return;
+    }
+    p = &xbRelay.pending[i];
+    memcpy(p->data, f->data, f->len);
+    ((XBEE_Relay*)p->data)->ttl--;
+    p->type = f->type;
+    p->dups = 0;
+    p->dueAt = msTicks + XB_RELAY_BACKOFF_MIN;
+    if (!GPS_Time(msTicks, &utc))
+        p->dueAt += rand() % (XB_RELAY_BACKOFF_MAX - XB_RELAY_BACKOFF_MIN);
+    p->len = f->len;
+}
+
+/*
+    Sends the relays that are due, as broadcasts in the message queue,
+    while our slot is open. Those enough other relays have already
+    covered are dropped. Call it every pass of the main loop.
+*/
+void XB_RelayService(Self *me, uint32 now) {
+    XB_Relayed *p;
+    int i;
+    
+    for (i = 0; i < XB_RELAY_PENDING; i++) {
+        p = &xbRelay.pending[i];
+        if (!p->len || (int32)(now - p->dueAt) < 0 || !inSlot(now))
+            continue;
+        if (p->dups >= XB_RELAY_DUPS)
+            ++xbRelay.numSuppressed;
+        else if (xbTx.msgCount == XB_TX_MSGS)
+            ++xbRelay.numDropped;
+        else {
+            memcpy(RELAY_HDR, p->data, p->len);
+            encodeFrame(msgTail(), p->type, p->len, NULL);
+            msgQueued();
+            XB_TxPump();
+            ++xbRelay.numRelayed;
+        }
+        p->len = 0;
+    }
+}
+
+#if XB_API_MODE
+/*
+    Asks our radio for the signal strength of the last packet it
+    received, which came from <u>. Skipped if the last query hasn't
+    been sent yet.
+*/
+static void queryRssi(User *u) {
+    if (xbTx.atReady)
+        return;
+    xbTx.at.len = XBAPI_AtCommand(xbTx.at.data, newAtId(u->uniqueID), "DB");
+    xbTx.atReady = 1;
+    XB_TxPump();
+}
+
+/*
+    Asks our radio for its AP setting, after first setting it to
+    XB_API_MODE and saving that if <set>. Skipped if the last AT command
+    hasn't been sent yet.
+*/
+static void queryAp(int set) {
+    uint16 n = 0;
+
+    if (xbTx.atReady)
+        return;
+    if (set) {
+        n += XBAPI_AtSet(xbTx.at.data, 0, "AP", XB_API_MODE);
+        n += XBAPI_AtCommand(xbTx.at.data + n, 0, "WR");
+    }
+    n += XBAPI_AtCommand(xbTx.at.data + n, newAtId(0), "AP");
+    xbTx.at.len = n;
+    xbTx.atReady = 1;
+    XB_TxPump();
+}
 
-    // Fill in the header
-    hdr.destID = dest->uniqueID;
-    memcpy(hdr.name, me->name, 20);
-    hdr.srcID = me->id;
-    hdr.type = MESSAGE;
+/*
+    Puts our radio in the API mode we were built for, and checks that it
+    took. A radio fresh from the factory is in transparent mode, so it
+    is told in command mode first, which +++ only enters with a guard
+    time of silence either side. A radio already in API mode drops all
+    of that as bytes outside a frame. Then the radio is asked for AP in
+    an API frame. XB_HandleApi puts the answer in xbTx.apMode, and sets
+    AP again if the radio is in the other API mode. Blocks for two guard
+    times, so call it at startup before anything else is sent.
+*/
+void XB_ConfigureApi() {
+    char cmd[] = "ATAP0,WR,CN\r";
+
+    cmd[4] = '0' + XB_API_MODE;
+    xbTx.apMode = XB_AP_UNKNOWN;
+    CyDelay(XB_GUARD_TIME);
+    XB_PutString("+++");
+    CyDelay(XB_GUARD_TIME);
+    XB_PutString(cmd);
+    CyDelay(100); // For the radio to leave command mode
+    queryAp(0);
+}
+
+/*
+    Handles a transmit status or AT command response from our radio,
+    crediting it to the user whose frame ID it carries. Each kind of
+    reply only counts with an ID from its own range.
+*/
+void XB_HandleApi(Self *me, XBAPI_Frame *a) {
+    uint8 id = a->data[1];
+    User *u;
     
-    // Fill in the message
-    memcpy(msg.msg, dest->tempMsg.msg, 250);
+    if (a->len < 6 || !id)
+        return;
     
-    // Send the data
-    XB_PutArray((uint8*)&hdr, sizeof(XBEE_Header));
-    XB_PutArray((uint8*)&msg, sizeof(XBEE_Message));
-    XB_PutArray((uint8*)"***", 3);
+    if (a->data[0] == XBAPI_TX_STATUS && id <= XB_TX_IDS) {
+        if (!(u = findUser(&me->users, xbTx.idOwner[id - 1], 0)))
+            return;
+        // Delivery status 0 means the destination acknowledged it
+        if (a->data[5] == 0)
+            ++u->numDelivered;
+        else
+            ++u->numFailed;
+    }
+    else if (a->data[0] == XBAPI_AT_RESPONSE && id > XB_TX_IDS &&
+             id <= XB_TX_IDS + XB_AT_IDS && a->data[4] == 0) {
+        if (a->data[2] == 'A' && a->data[3] == 'P') {
+            xbTx.apMode = a->data[5];
+            if (xbTx.apMode != XB_API_MODE)
+                queryAp(1);
+        }
+        else if (a->data[2] == 'D' && a->data[3] == 'B' &&
+                 (u = findUser(&me->users, xbTx.idOwner[id - 1], 0)))
+            u->rssi = a->data[5];
+    }
+}
+#endif
+
+RING_DEFINE(xbRing, XBL_Frame, 4);
+XBL_Framer xbFramer = {xbRingSlots, XB_PAYLOAD_MAX, XB_NUM_TYPES};
+#if XB_API_MODE
+RING_DEFINE(xbApiRing, XBAPI_Frame, 4);
+XBAPI_Framer xbApiFramer = {xbApiRingSlots};
+#endif
+
+// Runs one byte of the link stream through the link framer. Only
+// frames with a good CRC, a known type and the right length make it to
+// the main loop. <src> is the address of the radio it came from, in
+// API mode.
+static void rxLink(uint8 c, const uint8 *src) {
+    XBL_Frame *f = XBL_Feed(&xbFramer, c);
+
+    if (!f || f->type >= XB_NUM_TYPES
+        || f->len < sizeof(XBEE_Relay) + XBEE_MIN_SIZE[f->type]
+        || f->len > sizeof(XBEE_Relay) + XBEE_STR_SIZE[f->type])
+        return;
+    // Hand the frame to the main loop, even if it's for someone else,
+    // as it may need relaying
+    if (src)
+        memcpy(f->src, src, 8);
+    Ring_Commit(&xbRing);
+    xbFramer.f = Ring_Claim(&xbRing);
+}
+
+/*
+    Runs one byte received from the XBee through the framers, from the
+    RX interrupt or, with DMA reception, the tick. In API mode the RF
+    data of received packets goes on to the link framer, while transmit
+    statuses and AT command responses are handed to the main loop.
+*/
+void XB_RxByte(uint8 c) {
+#if XB_API_MODE
+    XBAPI_Frame *a = XBAPI_Feed(&xbApiFramer, c);
+    uint16 i;
+
+    if (!a)
+        return;
+    if (a->data[0] == XBAPI_RX_PACKET) {
+        for (i = XBAPI_RX_HEADER; i < a->len; i++)
+            rxLink(a->data[i], a->data + 1);
+    }
+    else if (a->data[0] == XBAPI_TX_STATUS || a->data[0] == XBAPI_AT_RESPONSE) {
+        Ring_Commit(&xbApiRing);
+        xbApiFramer.f = Ring_Claim(&xbApiRing);
+    }
+#else
+    rxLink(c, NULL);
+#endif
+}
+
+// Acts on the next received frame and radio reply, if any. Call it
+// every pass of the main loop.
+void XB_RxService(Self *me) {
+    XBL_Frame *f;
+#if XB_API_MODE
+    XBAPI_Frame *a;
+#endif
+
+    if ((f = Ring_Peek(&xbRing))) {
+        logXBdata(me, f);
+        Ring_Release(&xbRing);
+    }
+#if XB_API_MODE
+    if ((a = Ring_Peek(&xbApiRing))) {
+        XB_HandleApi(me, a);
+        Ring_Release(&xbApiRing);
+    }
+#endif
+}
+
+// Picks the next frame to send: radio commands, messages, then the beacon
+static XB_Frame *nextFrame() {
+    if (xbTx.atReady)
+        return &xbTx.at;
+    if (xbTx.msgCount)
+        return &xbTx.msg[xbTx.msgHead];
+    if (xbTx.beaconReady)
+        return &xbTx.beacon;
+    return NULL;
+}
+
+// Done with the current frame, free its slot
+static void frameSent() {
+    if (xbTx.cur == &xbTx.at)
+        xbTx.atReady = 0;
+    else if (xbTx.cur == &xbTx.beacon)
+        xbTx.beaconReady = 0;
+    else {
+        xbTx.msgHead = (xbTx.msgHead + 1) % XB_TX_MSGS;
+        --xbTx.msgCount;
+    }
+    xbTx.cur = NULL;
+}
+/*
+    Moves as much of the queue into the UART's TX buffer as fits without
+    waiting. Called from the TX interrupt as the buffer empties, and
+    after anything is queued to get it started.
+*/
+void XB_TxPump() {
+    uint8 intState = CyEnterCriticalSection();
+    uint16 space = XB_TX_BUFFER_SIZE - 1 - XB_GetTxBufferSize();
+    uint16 n;
     
-    // Clear out the temp message
-    dest->tempMsg.msgLen = 0;
-    dest->tempMsg.msg[0] = 0;
+    while (space) {
+        if (!xbTx.cur && !(xbTx.cur = nextFrame()))
+            break;
+        n = xbTx.cur->len - xbTx.sent;
+        if (n > space)
+            n = space;
+        XB_PutArray(xbTx.cur->data + xbTx.sent, n);
+        xbTx.sent += n;
+        space -= n;
+        if (xbTx.sent == xbTx.cur->len) {
+            frameSent();
+            xbTx.sent = 0;
+        }
+    }
+    CyExitCriticalSection(intState);
+}
+
+// Number of frames waiting to be sent, including the one going out
+uint8 XB_TxDepth() {
+    return xbTx.atReady + xbTx.msgCount + xbTx.beaconReady;
+}
+
+void XB_TXISR_ExitCallback() {
+    XB_TxPump();
 }
\ No newline at end of file
@@ -6,28 +6,276 @@
 #include <users.h>
 #include <Adafruit_RA8875.h>
 #include "display.h"
+#include "ring.h"
+#include "xblink.h"
+#include "xbapi.h"
     
-typedef enum {POSITION, MESSAGE, PROBE_REQ} XB_Payload_Type;
+// Sent as the link frame's type
+typedef enum {POSITION, MESSAGE, PROBE_REQ, ANNOUNCE} XB_Payload_Type;
 
+#define XB_NO_FIX ((int32)0x80000000) // Beacon lat and lon without a valid fix
+#define XB_ANNOUNCE_EVERY 10 // Beacons between announces
+#define XB_PROBE_GAP 1000 // Least milliseconds between probes
+#define XB_DR_ERROR 15 // Meters receivers' estimate of us may drift before a beacon
+#define XB_KEEPALIVE 30000 // Most milliseconds between beacons
+
+// Milliseconds between beacon checks for each XB_Rate setting
+static const uint16 xbRatePeriod[] = {3000, 2000, 1000};
+
+/*
+    Beacons go out in one of XB_NUM_SLOTS slots of a superframe that
+    starts on every GPS second, picked from a hash of our uID. Hearing
+    a beacon in our slot from a lower short ID moves us to another one
+    nobody has been heard in for XB_SLOT_MEMORY. There is a slot for
+    each user we can keep track of and one for us.
+*/
+#define XB_SUPERFRAME 1000 // Milliseconds
+#define XB_NUM_SLOTS (MAX_USERS + 1)
+#define XB_SLOT_MS (XB_SUPERFRAME / XB_NUM_SLOTS)
+#define XB_SLOT_GUARD 15 // Milliseconds at the end of a slot nothing is started in
+#define XB_SLOT_MEMORY (2 * XB_KEEPALIVE)
+
+/*
+    Starts every payload, so frames can be flooded across several hops.
+    Every node relays each (origin, seq) it hasn't seen before once, in
+    its own beacon slot, with the hop limit counted down. Without GPS
+    time there are no slots, and relays go out after a random back-off
+    instead. A node that hears XB_RELAY_DUPS other copies while it waits
+    leaves it to them.
+*/
+typedef struct XBEE_Relay {
+    uint16 origin; // Short ID of the node that sent it first
+    uint8  seq; // Counts the origin's frames
+    uint8  ttl; // Hops left, XB_RELAY_HOPS when sent first
+} XBEE_Relay;
+
+#define XB_RELAY_HOPS 4
+#define XB_RELAY_PENDING 4 // Frames that can wait out their back-off at once
+#define XB_RELAY_BACKOFF_MIN 10 // Milliseconds, also the least a relay waits in slotted mode
+#define XB_RELAY_BACKOFF_MAX 150
+#define XB_RELAY_DUPS 2
+#define XB_SEEN_ORIGINS MAX_USERS // Origins whose recent seqs are remembered
+#define XB_SEEN_TIMEOUT ((XB_RELAY_HOPS + 1) * XB_SUPERFRAME) // Longer than any copy is in flight
+
+/*
+    Starts every message fragment. Messages are sent at their real
+    length, split into as many fragments as it takes for each link frame
+    to fit in one radio packet. The sender's name isn't repeated here,
+    it comes from their announces.
+*/
 typedef struct XBEE_Header {
     uint32 destID; // uID of the dest, or 0 for broadcast
     uint32 srcID;
-    char  name[20];
-    XB_Payload_Type type;
+    uint8  msgID; // Tells the sender's messages apart
+    uint8  frag; // Index of the fragment in the high nibble, count - 1 in the low
 } XBEE_Header;
 
-typedef struct XBEE_Position {
-    float64  utc;
-    Position pos;
-} XBEE_Position;
+// Message text in each fragment; all but the last are full
+#define XB_FRAG_DATA (XBAPI_MAX_RF - XBL_OVERHEAD - sizeof(XBEE_Relay) - sizeof(XBEE_Header))
+#define XB_MAX_FRAGS ((MSG_MAX_LEN + XB_FRAG_DATA - 1) / XB_FRAG_DATA)
+#define XB_REASM_SLOTS 2 // Messages that can be reassembled at once
+#define XB_REASM_TIMEOUT 5000 // Milliseconds to wait for the missing fragments
+
+/*
+    Position beacon, the most frequent frame on the air, so it carries
+    only what changes. Users are identified by a short ID derived from
+    their uID; an unknown one is resolved by sending a PROBE_REQ for it,
+    which its owner answers with an ANNOUNCE.
+*/
+typedef struct XBEE_Beacon {
+    uint16 shortID;
+    uint8  tow[3]; // Tenths of a second into the UTC week, little endian
+    int32  lat; // 1e-7 degrees, XB_NO_FIX without a valid fix
+    int32  lon; // 1e-7 degrees
+    uint8  speed; // Quarters of a m/s, see XB_SPEED
+    uint8  course; // 256ths of a circle
+    uint8  slot; // Superframe slot the sender uses, XB_NUM_SLOTS if unslotted
+} XBEE_Beacon;
+
+// Beacon speed and course from and to centi-knots and centi-degrees
+#define XB_SPEED(_CK) ((_CK) >= 12393 ? 255 : ((_CK) * 10 + 243) / 486)
+#define XB_SPEED_CK(_S) ((_S) * 486 / 10)
+#define XB_COURSE(_CD) ((((uint32)(_CD) * 256 + 18000) / 36000) & 0xFF)
+#define XB_COURSE_CD(_C) ((_C) * 1125 / 8)
+
+// Sent instead of a beacon every XB_ANNOUNCE_EVERY periods, and when probed
+typedef struct XBEE_Announce {
+    XBEE_Beacon beacon;
+    uint32 uniqueID;
+    char   name[20];
+} XBEE_Announce;
+
+// Asks whoever has <shortID> to announce themselves
+typedef struct XBEE_Probe {
+    uint16 shortID;
+} XBEE_Probe;
+
+// Shortest and longest payload of each XB_Payload_Type, after the XBEE_Relay
+static const uint XBEE_MIN_SIZE[] = {sizeof(XBEE_Beacon),
+    sizeof(XBEE_Header), sizeof(XBEE_Probe), sizeof(XBEE_Announce)};
+static const uint XBEE_STR_SIZE[] = {sizeof(XBEE_Beacon),
+    sizeof(XBEE_Header) + XB_FRAG_DATA, sizeof(XBEE_Probe),
+    sizeof(XBEE_Announce)};
+#define XB_NUM_TYPES (sizeof(XBEE_STR_SIZE) / sizeof(XBEE_STR_SIZE[0]))
+
+// Longest payload and frame on the air, a full message fragment
+#define XB_PAYLOAD_MAX (sizeof(XBEE_Relay) + sizeof(XBEE_Header) + XB_FRAG_DATA)
+#define XB_FRAME_MAX (XBL_OVERHEAD + XB_PAYLOAD_MAX)
+
+// What the UART carries for one link frame. In API mode that is a
+// transmit request for each XBAPI_MAX_RF bytes, all possibly escaped.
+#if XB_API_MODE
+#define XB_TX_CHUNKS ((XB_FRAME_MAX + XBAPI_MAX_RF - 1) / XBAPI_MAX_RF)
+#define XB_TX_MAX ((XB_FRAME_MAX + XB_TX_CHUNKS * (XBAPI_TX_HEADER + XBAPI_OVERHEAD)) * XB_API_MODE)
+#else
+#define XB_TX_MAX XB_FRAME_MAX
+#endif
+
+// An encoded frame waiting to be sent
+typedef struct XB_Frame {
+    uint16 len;
+    uint8  data[XB_TX_MAX];
+} XB_Frame;
+
+/*
+    API frame IDs in flight at once. Transmit requests and AT commands
+    draw from separate ranges, so a burst of message fragments can't
+    reuse the ID of a query still waiting for its answer.
+*/
+#define XB_TX_IDS 32 // For transmit statuses, 1 to XB_TX_IDS
+#define XB_AT_IDS 8  // For AT command responses, the XB_AT_IDS after those
+
+#define XB_GUARD_TIME 1100 // ms of silence around +++, the radio's GT and some margin
+#define XB_AP_UNKNOWN 0xFF // apMode until the radio has answered
+
+#define XB_TX_MSGS 8 // Message fragments that can wait to be sent
+
+/*
+    Frames waiting to go out, drained into the UART from its TX
+    interrupt so nothing ever blocks on a full TX buffer. Commands to
+    our own radio go first, then messages, then position beacons. Only the newest beacon is
+    kept; one that hasn't started sending when the next is queued is
+    stale and gets replaced. A frame that has started is always
+    finished, so frames are never cut short on the air.
+*/
+typedef struct XB_TxQueue {
+    XB_Frame at; // AT command for our radio, API mode only
+    uint8    atReady;
+    XB_Frame msg[XB_TX_MSGS];
+    uint8    msgHead;
+    uint8    msgCount;
+    XB_Frame beacon;
+    uint8    beaconReady;
+    XB_Frame *cur; // Frame being sent, NULL when idle
+    uint16   sent; // Bytes of cur already handed to the UART
+    uint8    maxDepth; // Most messages ever waiting at once
+    uint16   numMsgDropped; // Messages dropped because the queue couldn't take all their fragments
+    uint16   numBeaconsReplaced; // Beacons replaced before they were sent
+    uint32   idOwner[XB_TX_IDS + XB_AT_IDS]; // uID of the user each frame ID's reply is about
+    uint8    lastTxId; // Within its range
+    uint8    lastAtId;
+    uint8    apMode; // AP setting our radio reported, see XB_ConfigureApi
+} XB_TxQueue;
+
+XB_TxQueue xbTx;
+
+/*
+    What receivers last heard from us. Beacons are only sent when the
+    dead-reckoned estimate receivers are making from it would be off
+    by more than XB_DR_ERROR, with one at least every XB_KEEPALIVE,
+    and then in our slot.
+*/
+typedef struct XB_BeaconState {
+    uint32 lastCheck; // msTicks of the last check
+    uint32 sentAt; // msTicks of the last beacon
+    int32  lat;
+    int32  lon;
+    uint16 groundSpeed; // In centi-knots, as the receivers decoded it
+    uint16 groundCourse; // In centi-degrees, likewise
+    uint8  fix; // Whether it had a position
+    uint8  force; // Send at the next check, e.g. we were probed
+    uint8  pending; // A beacon is due, waiting for our slot
+    uint8  slot; // Our superframe slot
+    uint8  salt; // Times the slot has been re-picked
+    uint32 slotHeardAt[XB_NUM_SLOTS]; // msTicks others were last heard in each slot
+    uint16 numSent;
+    uint16 numSkipped; // Checks that didn't need a beacon
+    uint16 numCollisions; // Others heard in our slot
+} XB_BeaconState;
+
+XB_BeaconState xbBeacon;
+
+// Someone else's frame waiting out its back-off to be relayed
+typedef struct XB_Relayed {
+    uint8  len; // Of the payload, 0 if the slot is free
+    uint8  type;
+    uint8  dups; // Copies heard from other relays since
+    uint32 dueAt; // msTicks
+    uint8  data[XB_PAYLOAD_MAX];
+} XB_Relayed;
+
+// The frames already handled from one origin
+typedef struct XB_Seen {
+    uint16 origin;
+    uint8  top; // Highest seq
+    uint8  topTtl; // Most hops left of any copy of it
+    uint32 recent; // Bit i set if seq top - i has been handled
+    uint32 heardAt; // msTicks of the last new one
+} XB_Seen;
+
+typedef struct XB_RelayState {
+    XB_Seen seen[XB_SEEN_ORIGINS];
+    uint8  numSeen;
+    XB_Relayed pending[XB_RELAY_PENDING];
+    uint8  seq; // Of our own frames
+    uint16 numRelayed;
+    uint16 numSuppressed; // Left to other relays
+    uint16 numDropped; // No room to wait or send
+} XB_RelayState;
+
+XB_RelayState xbRelay;
+
+// A message whose fragments are still arriving
+typedef struct XB_Reassembly {
+    uint32 srcID;
+    uint8  msgID;
+    uint8  count; // Fragments in the message, 0 if the slot is free
+    uint8  have; // Bit for each fragment received
+    uint16 len; // Known once the last fragment is in
+    uint32 started; // msTicks at the first fragment
+    char   text[MSG_MAX_LEN + 1];
+} XB_Reassembly;
+
+typedef struct XB_RxMessages {
+    XB_Reassembly slot[XB_REASM_SLOTS];
+    uint16 numTimedOut; // Messages given up on with fragments missing
+} XB_RxMessages;
 
-typedef struct XBEE_Message {
-    char  msg[255];
-} XBEE_Message;
+XB_RxMessages xbRx;
 
-static const uint XBEE_STR_SIZE[] = {sizeof(XBEE_Position), sizeof(XBEE_Message), 0};
+/*
+    Received link frames wait in xbRing, and replies from our own radio
+    in xbApiRing, for XB_RxService in the main loop. The framers write
+    straight into the ring slot they have claimed.
+*/
+extern Ring xbRing;
+extern XBL_Framer xbFramer;
+#if XB_API_MODE
+extern Ring xbApiRing;
+extern XBAPI_Framer xbApiFramer;
+#endif
 
+uint16 shortID(uint32 uniqueID);
+void XB_BeaconInit(Self *me);
+int  XB_BeaconDue(Self *me, uint32 now);
 void broadcastPosition(Self *me);
-void logXBdata(Self *me, void *data);
-void sendMessage(Self *me, User *dest);
+void XB_RelayService(Self *me, uint32 now);
+void logXBdata(Self *me, XBL_Frame *f);
+int  sendMessage(Self *me, User *dest);
+void XB_TxPump();
+uint8 XB_TxDepth();
+void XB_ConfigureApi();
+void XB_HandleApi(Self *me, XBAPI_Frame *a);
+void XB_RxByte(uint8 c);
+void XB_RxService(Self *me);
 #endif
\ No newline at end of file
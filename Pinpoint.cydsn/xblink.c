@@ -0,0 +1,140 @@
+#include "xblink.h"
+
+// CRC-16/CCITT of each nibble, so the CRC costs two lookups a byte
+static const uint16 crcNibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+// Adds one byte to a running CRC-16/CCITT
+uint16 XBL_Crc(uint16 crc, uint8 c) {
+    crc = (crc << 4) ^ crcNibble[(crc >> 12) ^ (c >> 4)];
+    crc = (crc << 4) ^ crcNibble[(crc >> 12) ^ (c & 0x0F)];
+    return crc;
+}
+
+enum {XBL_MORE, XBL_GOOD, XBL_BAD};
+
+// Runs one byte through the state machine. Returns XBL_GOOD when it
+// completes a frame with a good CRC and XBL_BAD when it ends a bad one,
+// or isn't a start byte while hunting.
+static uint8 step(XBL_Framer *fr, uint8 c) {
+    XBL_Frame *f = fr->f;
+
+    switch (fr->state) {
+        case XBL_HUNT:
+            if (c != XBL_START)
+                return XBL_BAD;
+            fr->crc = 0xFFFF;
+            fr->state = XBL_LEN_LO;
+            return XBL_MORE;
+        case XBL_LEN_LO:
+            f->len = c;
+            fr->state = XBL_LEN_HI;
+            break;
+        case XBL_LEN_HI:
+            f->len |= c << 8;
+            if (f->len > fr->maxLen) {
+                ++fr->numTooLong;
+                return XBL_BAD;
+            }
+            fr->state = XBL_TYPE;
+            break;
+        case XBL_TYPE:
+            if (c >= fr->numTypes) {
+                ++fr->numBadType;
+                return XBL_BAD;
+            }
+            f->type = c;
+            fr->pos = 0;
+            fr->state = f->len ? XBL_DATA : XBL_CRC_LO;
+            break;
+        case XBL_DATA:
+            f->data[fr->pos++] = c;
+            if (fr->pos == f->len)
+                fr->state = XBL_CRC_LO;
+            break;
+        case XBL_CRC_LO:
+            fr->rxCrc = c;
+            fr->state = XBL_CRC_HI;
+            return XBL_MORE;
+        case XBL_CRC_HI:
+            fr->rxCrc |= c << 8;
+            if (fr->rxCrc == fr->crc)
+                return XBL_GOOD;
+            ++fr->numBadCrc;
+            return XBL_BAD;
+    }
+    fr->crc = XBL_Crc(fr->crc, c);
+
+    return XBL_MORE;
+}
+
+// Forgets the first <n> held bytes. The rest haven't been run through
+// the state machine yet.
+static void drop(XBL_Framer *fr, uint16 n) {
+    fr->numHeld -= n;
+    memmove(fr->held, fr->held + n, fr->numHeld);
+    fr->next = 0;
+}
+
+/*
+    Feeds one received byte to the framer. Returns a pointer to the
+    finished frame when <c> completes one with a good CRC, otherwise
+    NULL. The caller must point fr->f at a new buffer before the next
+    byte if it wants to keep the returned frame.
+
+    A bad frame is counted and the bytes after its start byte are run
+    through again from the next start byte among them, if any. So one
+    byte can take up to maxLen + XBL_OVERHEAD steps, though only on a
+    corrupt stream. Should a good frame turn up partway through, the
+    bytes after it are left for the next call.
+*/
+XBL_Frame *XBL_Feed(XBL_Framer *fr, uint8 c) {
+    uint16 i;
+
+    // Idle line, nothing to hold on to
+    if (fr->state == XBL_HUNT && !fr->numHeld && c != XBL_START)
+        return NULL;
+
+    fr->held[fr->numHeld++] = c;
+    while (fr->next < fr->numHeld) {
+        switch (step(fr, fr->held[fr->next++])) {
+            case XBL_GOOD:
+                fr->state = XBL_HUNT;
+                drop(fr, fr->next);
+                return fr->f;
+            case XBL_BAD:
+                fr->state = XBL_HUNT;
+                for (i = 1; i < fr->next && fr->held[i] != XBL_START; i++)
+                    ;
+                drop(fr, i);
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    Writes a whole frame carrying <len> bytes of <payload> to <out>,
+    which must have room for len + XBL_OVERHEAD bytes. <payload> may
+    already be in place at out + 4. Returns the length of the frame.
+*/
+uint16 XBL_Encode(uint8 *out, uint8 type, const uint8 *payload, uint16 len) {
+    uint16 crc = 0xFFFF;
+    uint16 i;
+
+    out[0] = XBL_START;
+    out[1] = len & 0xFF;
+    out[2] = len >> 8;
+    out[3] = type;
+    if (payload != out + 4)
+        memmove(out + 4, payload, len);
+    for (i = 1; i < len + 4; i++)
+        crc = XBL_Crc(crc, out[i]);
+    out[len + 4] = crc & 0xFF;
+    out[len + 5] = crc >> 8;
+
+    return len + XBL_OVERHEAD;
+}
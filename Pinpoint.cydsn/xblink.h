@@ -0,0 +1,68 @@
+#pragma pack(1)
+
+#ifndef __XBLINK_H
+#define __XBLINK_H
+
+#include <cytypes.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+    Link layer for everything sent over the XBees. A frame is
+
+        0xA5, length (2 bytes), type, payload, CRC-16 (2 bytes)
+
+    with multi-byte values little endian. The length counts only the
+    payload. The CRC is CRC-16/CCITT (0x1021, starting at 0xFFFF) over
+    the length, type and payload. Nothing is escaped, so after a bad
+    frame the receiver hunts for the next start byte, starting just
+    after the bad frame's own.
+*/
+#define XBL_START    0xA5
+#define XBL_MAX_LEN  300 // Longest payload
+#define XBL_OVERHEAD 6   // Start, length, type and CRC
+#define XBL_ENCODED_MAX (XBL_MAX_LEN + XBL_OVERHEAD)
+
+// A received frame
+typedef struct XBL_Frame {
+    uint16 len; // Of the payload
+    uint8  type;
+    uint8  src[8]; // Address of the radio it came from, in API mode
+    uint8  data[XBL_MAX_LEN];
+} XBL_Frame;
+
+typedef enum {XBL_HUNT, XBL_LEN_LO, XBL_LEN_HI, XBL_TYPE, XBL_DATA,
+    XBL_CRC_LO, XBL_CRC_HI} xbl_state;
+
+/*
+    Incremental frame receiver, fed one byte at a time. The frame is
+    written straight into the buffer pointed to by <f> and the CRC
+    accumulated as it arrives. The bytes of the frame in progress are
+    also held on to, so that when it turns out to be bad the framer can
+    go back and look for a start byte inside it: a lost byte then costs
+    only the frame it was in, not the one after as well.
+
+    <maxLen> and <numTypes> are set by the user of the link, and frames
+    that are longer or of a type that isn't below <numTypes> are dropped
+    as soon as their header is in.
+*/
+typedef struct XBL_Framer {
+    XBL_Frame *f; // Where the frame in progress is written
+    uint16 maxLen; // Longest payload accepted, at most XBL_MAX_LEN
+    uint16 numTypes; // Types accepted are 0 to numTypes - 1
+    xbl_state state;
+    uint16 pos;
+    uint16 crc; // Calculated so far
+    uint16 rxCrc; // The CRC sent with the frame
+    uint8  held[XBL_ENCODED_MAX]; // From the start byte on, and any not yet rescanned
+    uint16 numHeld;
+    uint16 next; // Next held byte to run through the state machine
+    uint16 numBadCrc;
+    uint16 numTooLong; // Frames whose length was over maxLen
+    uint16 numBadType;
+} XBL_Framer;
+
+uint16 XBL_Crc(uint16 crc, uint8 c);
+XBL_Frame *XBL_Feed(XBL_Framer *fr, uint8 c);
+uint16 XBL_Encode(uint8 *out, uint8 type, const uint8 *payload, uint16 len);
+#endif
@@ -0,0 +1,207 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "nmea.h"
+#include "hostutil.h"
+
+/*
+    Accuracy and cost of the fixed-point coordinate path against the
+    floating point one it replaced. Errors are measured against double
+    precision great circle math. The original DDMtoDD and distance come
+    from legacy/. deadReckon had no floating point version, so it is
+    compared with the same model written in doubles. The host has an
+    FPU, so the floating point cycle counts are far lower than the
+    board's soft float.
+
+    bench_fixed [-n samples]
+*/
+
+// legacy/nmea.c, built with its names prefixed
+double legacy_DDMtoDD(double coord);
+float legacy_distance(float64 destLat, float64 destLon, float64 curLat, float64 curLon,
+ float *latDist, float *lonDist);
+
+#define R_EARTH 6371000.0 // Meters, as the fixed-point kernels use
+#define RAD(_d) ((_d) * M_PI / 180)
+#define MILES 1609.344
+
+static volatile double sink;
+
+static double uniform(double lo, double hi) {
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+// Great circle distance in meters
+static double haversine(double lat1, double lon1, double lat2, double lon2) {
+    double a = pow(sin(RAD(lat2 - lat1) / 2), 2)
+             + cos(RAD(lat1)) * cos(RAD(lat2)) * pow(sin(RAD(lon2 - lon1) / 2), 2);
+    
+    return 2 * R_EARTH * asin(sqrt(a));
+}
+
+// Where <dist> meters along <course> degrees from lat, lon ends up
+static void destination(double lat, double lon, double course, double dist,
+ double *lat2, double *lon2) {
+    double d = dist / R_EARTH, p1 = RAD(lat), b = RAD(course);
+    double p2 = asin(sin(p1) * cos(d) + cos(p1) * sin(d) * cos(b));
+    
+    *lat2 = p2 * 180 / M_PI;
+    *lon2 = lon + atan2(sin(b) * sin(d) * cos(p1), cos(d) - sin(p1) * sin(p2)) * 180 / M_PI;
+}
+
+// deadReckon's flat earth model in doubles, what it would be without fixed point
+static void deadReckonDouble(double *lat, double *lon, double knots, double course, double s) {
+    double m = knots * 0.514444 * s;
+    
+    *lat += m * cos(RAD(course)) / (R_EARTH * M_PI / 180);
+    *lon += m * sin(RAD(course)) / (R_EARTH * M_PI / 180 * cos(RAD(*lat)));
+}
+
+typedef struct Stats {
+    double max, sum;
+    double maxRel, sumRel; // Percent of the reference, if there is one
+    long n;
+    uint64_t cyc;
+} Stats;
+
+static void add(Stats *s, double err, double ref) {
+    err = fabs(err);
+    if (err > s->max)
+        s->max = err;
+    s->sum += err;
+    if (ref) {
+        if (100 * err / ref > s->maxRel)
+            s->maxRel = 100 * err / ref;
+        s->sumRel += 100 * err / ref;
+    }
+    ++s->n;
+}
+
+static void report(const char *name, Stats *s) {
+    printf("  %-22s max %9.4f m  mean %9.5f m", name, s->max, s->sum / s->n);
+    if (s->sumRel)
+        printf("  max %7.4f%%  mean %7.4f%%", s->maxRel, s->sumRel / s->n);
+    printf("  %5.0f cycles\n", (double)s->cyc / s->n);
+}
+
+static void benchDDM(long n) {
+    Stats fixed = {0}, legacy = {0};
+    char text[32];
+    long i;
+    
+    printf("DDMtoDD, ddmm.mmmm fields at 4 and 5 decimals, error against exact\n");
+    for (i = 0; i < n; i++) {
+        int lon = i & 1, decimals = 4 + (i >> 1 & 1);
+        long scale = decimals == 4 ? 10000 : 100000;
+        long deg = rand() % (lon ? 180 : 90);
+        long min = (long)(uniform(0, 60) * scale);
+        double exact = deg + (double)min / scale / 60, d;
+        uint64_t c;
+        int32 got;
+        
+        sprintf(text, "%0*ld%02ld.%0*ld", lon ? 3 : 2, deg, min / scale, decimals, min % scale);
+        c = cycles();
+        got = DDMtoDD(text, 'N');
+        fixed.cyc += cycles() - c;
+        // Meters on the ground, at the equator for longitude
+        add(&fixed, (got / 1e7 - exact) * RAD(R_EARTH), 0);
+        
+        c = cycles();
+        d = legacy_DDMtoDD(atof(text));
+        legacy.cyc += cycles() - c;
+        add(&legacy, (d - exact) * RAD(R_EARTH), 0);
+        sink += got + d;
+    }
+    report("fixed (1e-7 deg)", &fixed);
+    report("legacy (double)", &legacy);
+}
+
+static void benchDistance(long n) {
+    static const double ranges[] = {100, 1000, 10000, 100000};
+    int r;
+    
+    printf("distance, error against haversine, away from the antimeridian, which\n"
+           "the legacy version didn't handle. The fixed one returns whole meters.\n");
+    for (r = 0; r < 4; r++) {
+        Stats fixed = {0}, legacy = {0};
+        long i;
+        
+        for (i = 0; i < n; i++) {
+            double lat1 = uniform(-70, 70), lon1 = uniform(-178, 178), lat2, lon2, ref;
+            float latD, lonD, d;
+            int32 la1, lo1, la2, lo2;
+            uint64_t c;
+            uint32 m;
+            
+            destination(lat1, lon1, uniform(0, 360), ranges[r] * uniform(0.5, 1), &lat2, &lon2);
+            la1 = lrint(lat1 * 1e7);
+            lo1 = lrint(lon1 * 1e7);
+            la2 = lrint(lat2 * 1e7);
+            lo2 = lrint(lon2 * 1e7);
+            ref = haversine(la1 / 1e7, lo1 / 1e7, la2 / 1e7, lo2 / 1e7);
+            
+            c = cycles();
+            m = distance(la2, lo2, la1, lo1, NULL, NULL);
+            fixed.cyc += cycles() - c;
+            add(&fixed, m - ref, ref);
+            
+            c = cycles();
+            d = legacy_distance(la2 / 1e7, lo2 / 1e7, la1 / 1e7, lo1 / 1e7, &latD, &lonD);
+            legacy.cyc += cycles() - c;
+            add(&legacy, d * MILES - ref, ref);
+            sink += m + d;
+        }
+        printf(" up to %g km\n", ranges[r] / 1000);
+        report("fixed", &fixed);
+        report("legacy (float miles)", &legacy);
+    }
+}
+
+static void benchDeadReckon(long n) {
+    static const uint32 spans[] = {1000, 10000, 60000};
+    int r;
+    
+    printf("deadReckon, 0 to 100 knots, error against a great circle\n");
+    for (r = 0; r < 3; r++) {
+        Stats fixed = {0}, flat = {0};
+        long i;
+        
+        for (i = 0; i < n; i++) {
+            double lat = uniform(-70, 70), lon = uniform(-179, 179), lat2, lon2, dlat, dlon;
+            uint16 speed = rand() % 10000, course = rand() % 36000;
+            int32 fl = lrint(lat * 1e7), fo = lrint(lon * 1e7);
+            uint64_t c;
+            
+            destination(fl / 1e7, fo / 1e7, course / 100.0, speed / 100.0 * 0.514444 * spans[r] / 1000,
+                        &lat2, &lon2);
+            
+            c = cycles();
+            deadReckon(&fl, &fo, speed, course, spans[r]);
+            fixed.cyc += cycles() - c;
+            add(&fixed, haversine(fl / 1e7, fo / 1e7, lat2, lon2), 0);
+            
+            dlat = lrint(lat * 1e7) / 1e7;
+            dlon = lrint(lon * 1e7) / 1e7;
+            c = cycles();
+            deadReckonDouble(&dlat, &dlon, speed / 100.0, course / 100.0, spans[r] / 1000.0);
+            flat.cyc += cycles() - c;
+            add(&flat, haversine(dlat, dlon, lat2, lon2), 0);
+            sink += fl + dlat;
+        }
+        printf(" over %.0f s\n", spans[r] / 1000.0);
+        report("fixed", &fixed);
+        report("same model in double", &flat);
+    }
+}
+
+int main(int argc, char **argv) {
+    long n = 200000;
+    
+    if (argc > 2 && !strcmp(argv[1], "-n"))
+        n = atol(argv[2]);
+    srand(3);
+    benchDDM(n);
+    benchDistance(n);
+    benchDeadReckon(n);
+    return 0;
+}
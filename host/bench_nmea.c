@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "nmea.h"
+#include "hostutil.h"
+
+/*
+    Throughput of the GPS receive path on the NMEA corpus: every byte
+    through feedNMEA, then parseNMEA and the same hand-off as main.c's
+    logGPSdata. The parser is also timed on its own, over sentences
+    framed beforehand.
+
+    bench_nmea [-t seconds] corpus.nmea...
+*/
+
+static NAV_Assembler nav;
+static GSV_Assembler gsv;
+
+// What logGPSdata does with a parsed sentence
+static nmea_type dispatch(NMEA_Sentence *s) {
+    char info[100];
+    nmea_type type = parseNMEA(s, info);
+    
+    if (type == GSV)
+        assembleGSV(&gsv, (GSV_Msg*)info);
+    else if (type < GSV || type == RMC)
+        fuseNav(&nav, type, info);
+    return type;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 1;
+    Corpus c;
+    NMEA_Sentence s, *framed = NULL;
+    NMEA_Framer fr = {&s};
+    size_t i, numFramed = 0, numFields = 0, passes, numInvalid = 0;
+    uint64_t start, elapsed, clk;
+    char info[100];
+    
+    if (argc > 2 && !strcmp(argv[1], "-t")) {
+        seconds = atof(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: bench_nmea [-t seconds] corpus.nmea...\n");
+        return 2;
+    }
+    loadCorpus(&c, argc - 1, argv + 1);
+    
+    // Frame the corpus once, to count it and to time parsing on its own
+    framed = malloc(c.len / 8 * sizeof(NMEA_Sentence));
+    for (i = 0; i < c.len; i++) {
+        if (feedNMEA(&fr, c.text[i])) {
+            framed[numFramed++] = s;
+            numFields += s.numFields;
+            if (dispatch(&s) == INVALID)
+                ++numInvalid;
+        }
+    }
+    printf("corpus: %zu bytes, %zu sentences, %zu fields, %u bad checksums, "
+           "%u malformed, %zu not parsed\n", c.len, numFramed, numFields,
+           fr.numBadChecksum, fr.numMalformed, numInvalid);
+    if (!numFramed)
+        return 1;
+    
+    // Framing, parsing and hand-off, as the board does it
+    start = nowNs();
+    for (passes = 0; (elapsed = nowNs() - start) < seconds * 1e9; passes++) {
+        for (i = 0; i < c.len; i++) {
+            if (feedNMEA(&fr, c.text[i]))
+                dispatch(&s);
+        }
+    }
+    printf("feed+parse: %10.0f sentences/s %7.1f ns/field %7.1f ns/byte\n",
+           1e9 * passes * numFramed / elapsed, (double)elapsed / (passes * numFields),
+           (double)elapsed / (passes * c.len));
+    
+    // Parsing alone
+    start = nowNs();
+    clk = cycles();
+    for (passes = 0; (elapsed = nowNs() - start) < seconds * 1e9; passes++) {
+        for (i = 0; i < numFramed; i++) {
+            s = framed[i];
+            parseNMEA(&s, info);
+        }
+    }
+    clk = cycles() - clk;
+    printf("parse only: %10.0f sentences/s %7.1f ns/field %7.0f cycles/sentence\n",
+           1e9 * passes * numFramed / elapsed, (double)elapsed / (passes * numFields),
+           (double)clk / (passes * numFramed));
+    free(framed);
+    freeCorpus(&c);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "nmea.h"
+#include "hostutil.h"
+
+/*
+    Cycles per sentence of the receive path before and after the
+    single-pass tokenizer. "Before" is the original parser in legacy/,
+    which scanned each field with the extract macro once the RX ISR had
+    copied the sentence into a buffer. "After" is feedNMEA on every byte
+    followed by parseNMEA. Only the sentence types both understand are
+    timed. The host's sscanf and atof aren't newlib's, so the ratio
+    matters more than the counts.
+
+    bench_parser [-t seconds] corpus.nmea...
+*/
+
+// legacy/nmea.c, built with its names prefixed
+int legacy_parseNMEA(char *sentence, void *strStruct);
+
+static const char *typeName[] = {"GGA", "GSA", "GSV", "RMC", "VTG"};
+#define NUM_TYPES 5
+
+typedef struct Sample {
+    char *line;
+    size_t len;
+    int type;
+} Sample;
+
+int main(int argc, char **argv) {
+    double seconds = 1;
+    Corpus c;
+    Sample *samples;
+    NMEA_Sentence s;
+    NMEA_Framer fr = {&s};
+    char info[128], old[NMEA_MAX_LEN + 4];
+    size_t i, j, k, numSamples = 0, count[NUM_TYPES] = {0};
+    uint64_t before[NUM_TYPES] = {0}, after[NUM_TYPES] = {0}, t, passes;
+    uint64_t totalBefore = 0, totalAfter = 0, total = 0;
+    
+    if (argc > 2 && !strcmp(argv[1], "-t")) {
+        seconds = atof(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: bench_parser [-t seconds] corpus.nmea...\n");
+        return 2;
+    }
+    loadCorpus(&c, argc - 1, argv + 1);
+    
+    samples = malloc(c.numLines * sizeof(Sample));
+    for (i = 0; i < c.numLines; i++) {
+        for (j = 0; j < NUM_TYPES; j++) {
+            if (!strncmp(c.lines[i], "$GP", 3) && !strncmp(c.lines[i] + 3, typeName[j], 3))
+                break;
+        }
+        if (j == NUM_TYPES || strlen(c.lines[i]) > NMEA_MAX_LEN)
+            continue;
+        samples[numSamples].line = c.lines[i];
+        samples[numSamples].len = strlen(c.lines[i]);
+        samples[numSamples++].type = j;
+        ++count[j];
+    }
+    
+    // Interleave the two so both see the same cache and clock
+    passes = 0;
+    for (t = nowNs(); nowNs() - t < seconds * 2e9; passes++) {
+        for (i = 0; i < numSamples; i++) {
+            Sample *p = &samples[i];
+            uint64_t c0 = cycles(), c1, c2;
+            
+            // The original RX ISR collected the sentence, then it was parsed
+            for (k = 0; k < p->len; k++)
+                old[k] = p->line[k];
+            old[k] = '\0';
+            if (legacy_parseNMEA(old, info) != p->type)
+                return fprintf(stderr, "legacy parser rejected %s\n", p->line), 1;
+            c1 = cycles();
+            
+            for (k = 0; k < p->len; k++)
+                feedNMEA(&fr, p->line[k]);
+            feedNMEA(&fr, '\r');
+            if (!feedNMEA(&fr, '\n') || parseNMEA(&s, info) != p->type)
+                return fprintf(stderr, "parser rejected %s\n", p->line), 1;
+            c2 = cycles();
+            
+            before[p->type] += c1 - c0;
+            after[p->type] += c2 - c1;
+        }
+    }
+    
+    printf("%-5s %9s %16s %16s %8s\n", "type", "sentences", "before cyc/sent",
+           "after cyc/sent", "speedup");
+    for (j = 0; j < NUM_TYPES; j++) {
+        if (!count[j])
+            continue;
+        printf("%-5s %9zu %16.0f %16.0f %7.1fx\n", typeName[j], count[j],
+               (double)before[j] / (passes * count[j]), (double)after[j] / (passes * count[j]),
+               (double)before[j] / after[j]);
+        totalBefore += before[j];
+        totalAfter += after[j];
+        total += count[j];
+    }
+    printf("%-5s %9llu %16.0f %16.0f %7.1fx\n", "all", (unsigned long long)total,
+           (double)totalBefore / (passes * total), (double)totalAfter / (passes * total),
+           (double)totalBefore / totalAfter);
+    free(samples);
+    freeCorpus(&c);
+    return 0;
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Writes mtk3339.nmea, the corpus the host benchmark and fuzzer start
+from. It follows what an MTK3339 puts out at 1 Hz with the default
+sentence mix (GGA, GSA, GSV, RMC, VTG every fix): the PMTK boot
+messages, half a minute without a fix, then a walk with the satellites
+slowly moving, the odd dropped SNR and a PMTK001 acknowledgement when
+the rate is changed.
+
+A log recorded from a real receiver through the replay mirror mode
+($PPNT,MODE,MIRROR) can be dropped in alongside it; every *.nmea file
+here is used.
+
+    python3 mkcorpus.py > mtk3339.nmea
+"""
+import math
+import random
+
+random.seed(3339)
+
+
+def sentence(body):
+    checksum = 0
+    for c in body:
+        checksum ^= ord(c)
+    return "$%s*%02X" % (body, checksum)
+
+
+def ddm(deg, pos, neg, width):
+    hemi = pos if deg >= 0 else neg
+    deg = abs(deg)
+    whole = int(deg)
+    return "%0*d%07.4f" % (width, whole, (deg - whole) * 60), hemi
+
+
+def utc(t):
+    return "%02d%02d%02d.%03d" % (t // 3600 % 24, t // 60 % 60, t % 60, 0)
+
+
+class Sat:
+    def __init__(self, prn):
+        self.prn = prn
+        self.elev = random.uniform(5, 85)
+        self.azim = random.uniform(0, 360)
+        self.snr = random.randint(20, 46)
+
+    def step(self):
+        self.elev = min(89, max(1, self.elev + random.uniform(-0.02, 0.02)))
+        self.azim = (self.azim + random.uniform(0, 0.03)) % 360
+        if random.random() < 0.2:
+            self.snr = min(50, max(15, self.snr + random.randint(-2, 2)))
+
+
+def main():
+    out = [sentence("PMTK011,MTKGPS"), sentence("PMTK010,001")]
+    sats = [Sat(p) for p in random.sample(range(1, 33), 11)]
+    t0 = 19 * 3600 + 42 * 60 + 7
+    lat, lon = 35.300217, -120.662390 # Starts in San Luis Obispo
+    course, speed = 42.0, 0.0
+    date = "170226"
+
+    for i in range(330):
+        t = t0 + i
+        fix = i >= 30
+        for s in sats:
+            s.step()
+        if fix:
+            speed = max(0.0, min(4.5, speed + random.uniform(-0.3, 0.35)))
+            course = (course + random.uniform(-6, 6)) % 360
+            d = speed * 0.514444 / 6371000 # Radians this second
+            lat += math.degrees(d * math.cos(math.radians(course)))
+            lon += math.degrees(d * math.sin(math.radians(course))
+                                / math.cos(math.radians(lat)))
+        used = sorted(sats, key=lambda s: -s.snr)[:8] if fix else []
+        hdop = 0.85 + random.random() * 0.3
+        pdop = hdop * 1.7
+        vdop = hdop * 1.4
+        la, ns = ddm(lat, "N", "S", 2)
+        lo, ew = ddm(lon, "E", "W", 3)
+        alt = 94.3 + random.uniform(-1.5, 1.5)
+
+        if fix:
+            out.append(sentence("GPGGA,%s,%s,%s,%s,%s,1,%02d,%.2f,%.1f,M,-32.9,M,,"
+                                % (utc(t), la, ns, lo, ew, len(used), hdop, alt)))
+            out.append(sentence("GPGSA,A,3,%s,%.2f,%.2f,%.2f"
+                                % (",".join(["%02d" % s.prn for s in used]
+                                            + [""] * (12 - len(used))),
+                                   pdop, hdop, vdop)))
+        else:
+            out.append(sentence("GPGGA,%s,,,,,0,%02d,,,M,,M,,"
+                                % (utc(t), 0)))
+            out.append(sentence("GPGSA,A,1,,,,,,,,,,,,,,,"))
+
+        # Four satellites per GSV, in view order
+        visible = [s for s in sats if fix or i > 10]
+        n = (len(visible) + 3) // 4
+        for m in range(n):
+            fields = []
+            for s in visible[m * 4:m * 4 + 4]:
+                snr = "" if not fix and random.random() < 0.5 else "%02d" % s.snr
+                fields.append("%02d,%02d,%03d,%s" % (s.prn, s.elev, s.azim, snr))
+            out.append(sentence("GPGSV,%d,%d,%02d,%s" % (n, m + 1, len(visible),
+                                                        ",".join(fields))))
+
+        if fix:
+            out.append(sentence("GPRMC,%s,A,%s,%s,%s,%s,%.2f,%.2f,%s,,,A"
+                                % (utc(t), la, ns, lo, ew, speed, course, date)))
+            out.append(sentence("GPVTG,%.2f,T,,M,%.2f,N,%.2f,K,A"
+                                % (course, speed, speed * 1.852)))
+        else:
+            out.append(sentence("GPRMC,%s,V,,,,,0.00,0.00,%s,,,N" % (utc(t), date)))
+            out.append(sentence("GPVTG,0.00,T,,M,0.00,N,0.00,K,N"))
+
+        if i == 31:
+            out.append(sentence("PMTK001,220,3"))
+            out.append(sentence("PMTK001,314,3"))
+
+    print("\r\n".join(out), end="\r\n")
+
+
+if __name__ == "__main__":
+    main()
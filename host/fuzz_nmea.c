@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "nmea.h"
+
+/*
+    Fuzz target for the GPS receive path: arbitrary bytes go through
+    feedNMEA, and every sentence it lets through goes to parseNMEA and
+    on to assembleGSV or fuseNav, as in main.c. The sentence and the
+    parsed output are copied to buffers of exactly their size, so the
+    sanitizers catch the smallest overrun.
+
+    Built with -DHOST_LIBFUZZER and -fsanitize=fuzzer this is a
+    libFuzzer target. Otherwise it gets the driver below, which runs
+    the corpus and then mutations of it, fixing up the checksum of most
+    so they get past the framer:
+
+    fuzz_nmea [-runs n] [-seed n] corpus.nmea...
+*/
+
+typedef union NMEA_Output {
+    GGA_Str  gga;
+    GSA_Str  gsa;
+    GSV_Msg  gsv;
+    RMC_Str  rmc;
+    VTG_Str  vtg;
+    PMTK_Ack ack;
+} NMEA_Output;
+
+static NAV_Assembler nav;
+static GSV_Assembler gsv;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    NMEA_Sentence *buf = malloc(sizeof(NMEA_Sentence)), *s;
+    NMEA_Framer fr = {buf};
+    NMEA_Output *out;
+    NAV_Solution sol;
+    nmea_type type;
+    size_t i;
+    
+    for (i = 0; i < size; i++) {
+        if (!feedNMEA(&fr, data[i]))
+            continue;
+        s = malloc(sizeof(NMEA_Sentence));
+        *s = *buf;
+        out = malloc(sizeof(NMEA_Output));
+        type = parseNMEA(s, out);
+        if (type == GSV)
+            assembleGSV(&gsv, &out->gsv);
+        else if (type == GGA || type == GSA || type == RMC || type == VTG)
+            fuseNav(&nav, type, out);
+        readNav(&nav, &sol);
+        free(out);
+        free(s);
+    }
+    free(buf);
+    return 0;
+}
+
+#ifndef HOST_LIBFUZZER
+#include "hostutil.h"
+
+// Rewrites the checksum of <line> to match, if it has room for one
+static void fixChecksum(char *line, size_t len) {
+    char *star = memchr(line, '*', len);
+    uint8 checksum = 0;
+    char *p;
+    
+    if (!star || line[0] != '$' || star + 3 > line + len)
+        return;
+    for (p = line + 1; p < star; p++)
+        checksum ^= *p;
+    sprintf(star + 1, "%02X", checksum);
+    star[3] = '\r';
+}
+
+// Scrambles <line> in place, in one of the ways a corrupt link or odd receiver might
+static size_t mutate(char *line, size_t len, size_t cap) {
+    static const char interesting[] = ",,*$.-\r\n9";
+    size_t i, n;
+    
+    switch (rand() % 6) {
+        case 0: // Flip some bits
+            for (n = rand() % 4 + 1; n; n--)
+                line[rand() % len] ^= 1 << rand() % 8;
+            break;
+        case 1: // Drop a run
+            i = rand() % len;
+            n = rand() % (len - i) + 1;
+            memmove(line + i, line + i + n, len - i - n);
+            len -= n;
+            break;
+        case 2: // Repeat a run, e.g. extra fields
+            i = rand() % len;
+            n = rand() % (len - i) + 1;
+            if (len + n > cap)
+                n = cap - len;
+            memmove(line + i + n, line + i, len - i);
+            len += n;
+            break;
+        case 3: // Structural characters
+            for (n = rand() % 3 + 1; n; n--)
+                line[rand() % len] = interesting[rand() % (sizeof(interesting) - 1)];
+            break;
+        case 4: // Long digit runs
+            i = rand() % len;
+            for (n = rand() % 24; n && i < len; n--)
+                line[i++] = '0' + rand() % 10;
+            break;
+        default: // Big numbers in the GSV header and satellite fields
+            for (n = rand() % 3 + 1; n; n--) {
+                char *comma = memchr(line + rand() % len, ',', len / 2);
+                
+                if (comma && comma + 3 < line + len)
+                    memcpy(comma + 1, rand() % 2 ? "99" : "0", rand() % 2 + 1);
+            }
+            break;
+    }
+    if (len && rand() % 4)
+        fixChecksum(line, len);
+    return len;
+}
+
+int main(int argc, char **argv) {
+    long runs = 100000, r;
+    unsigned seed = 1;
+    char buf[4 * NMEA_MAX_LEN];
+    size_t i, len;
+    Corpus c;
+    
+    while (argc > 2 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-runs"))
+            runs = atol(argv[2]);
+        else if (!strcmp(argv[1], "-seed"))
+            seed = atoi(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: fuzz_nmea [-runs n] [-seed n] corpus.nmea...\n");
+        return 2;
+    }
+    loadCorpus(&c, argc - 1, argv + 1);
+    srand(seed);
+    
+    LLVMFuzzerTestOneInput((uint8_t*)c.text, c.len);
+    for (r = 0; r < runs; r++) {
+        // A few sentences back to back, at least one of them scrambled
+        len = 0;
+        for (i = rand() % 3 + 1; i; i--) {
+            const char *line = c.lines[rand() % c.numLines];
+            size_t n = strlen(line);
+            
+            if (len + n + 2 > sizeof(buf) / 2)
+                break;
+            memcpy(buf + len, line, n);
+            if (i == 1 || !(rand() % 3))
+                n = mutate(buf + len, n, sizeof(buf) / 2 - len);
+            len += n;
+            memcpy(buf + len, "\r\n", 2);
+            len += 2;
+        }
+        LLVMFuzzerTestOneInput((uint8_t*)buf, len);
+    }
+    freeCorpus(&c);
+    printf("fuzz_nmea: %ld runs, no faults\n", runs);
+    return 0;
+}
+#endif
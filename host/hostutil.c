@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "hostutil.h"
+
+int numChecks;
+
+// Reads <files> into <c>, exiting if one can't be read
+void loadCorpus(Corpus *c, int numFiles, char **files) {
+    size_t i, start, cap = 0;
+    FILE *f;
+    long n;
+    int j;
+    
+    memset(c, 0, sizeof(*c));
+    for (j = 0; j < numFiles; j++) {
+        if (!(f = fopen(files[j], "rb")) || fseek(f, 0, SEEK_END) || (n = ftell(f)) < 0) {
+            fprintf(stderr, "Can't read %s\n", files[j]);
+            exit(1);
+        }
+        rewind(f);
+        c->text = realloc(c->text, c->len + n + 1);
+        c->len += fread(c->text + c->len, 1, n, f);
+        fclose(f);
+    }
+    if (!c->len) {
+        fprintf(stderr, "Empty corpus\n");
+        exit(1);
+    }
+    c->text[c->len] = '\0';
+    
+    // Split a copy into lines, so the stream stays intact
+    for (i = start = 0; i <= c->len; i++) {
+        if (i < c->len && c->text[i] != '\n')
+            continue;
+        if (i > start + 1) {
+            if (c->numLines == cap)
+                c->lines = realloc(c->lines, (cap = cap * 2 + 256) * sizeof(char*));
+            c->lines[c->numLines] = strndup(c->text + start, i - start);
+            c->lines[c->numLines][strcspn(c->lines[c->numLines], "\r")] = '\0';
+            ++c->numLines;
+        }
+        start = i + 1;
+    }
+}
+
+void freeCorpus(Corpus *c) {
+    size_t i;
+    
+    for (i = 0; i < c->numLines; i++)
+        free(c->lines[i]);
+    free(c->lines);
+    free(c->text);
+    memset(c, 0, sizeof(*c));
+}
+
+uint64_t nowNs() {
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+// Time stamp counter where there is one, otherwise nanoseconds
+uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
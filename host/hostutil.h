@@ -0,0 +1,32 @@
+#ifndef __HOSTUTIL_H
+#define __HOSTUTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Helpers shared by the host benchmarks and tests: loading the
+    NMEA corpus, timing, and checks.
+*/
+typedef struct Corpus {
+    char  *text; // Every file, one after the other
+    size_t len;
+    char **lines; // Each sentence, NULL-terminated, without the CR LF
+    size_t numLines;
+} Corpus;
+
+void     loadCorpus(Corpus *c, int numFiles, char **files);
+void     freeCorpus(Corpus *c);
+uint64_t nowNs();
+uint64_t cycles();
+
+// Counts a passing check, or stops the test at the first failing one
+extern int numChecks;
+#define CHECK(_c) do { \
+    if (!(_c)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_c); \
+        exit(1); \
+    } \
+    ++numChecks; \
+} while (0)
+#endif
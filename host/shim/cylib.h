@@ -0,0 +1,40 @@
+/*
+    Host stand-in for cylib.h. Critical sections do nothing, as host
+    builds have no interrupts; the DMA calls drive the simulated
+    controller in sim_dma.c when a test links it.
+*/
+#ifndef CY_BOOT_CYLIB_H
+#define CY_BOOT_CYLIB_H
+
+#include <string.h>
+#include "cytypes.h"
+
+void  CyDelay(uint32 milliseconds);
+void  CyGetUniqueId(uint32 *uniqueId);
+uint8 CyEnterCriticalSection(void);
+void  CyExitCriticalSection(uint8 savedIntrStatus);
+
+void  CySysTickStart(void);
+cyisraddress CySysTickSetCallback(uint32 number, cyisraddress function);
+
+// DMA controller, see sim_dma.c
+typedef struct dmac_tdmem_struct {
+    reg8 TD0[4]; // Transfer count (12 bits), next TD, configuration
+    reg8 TD1[4]; // Low 16 bits of the source and destination
+} dmac_tdmem_struct;
+
+#define CY_DMA_NUMBEROF_TDS 128
+#define CY_DMA_DISABLED_TD  0xFE
+#define CY_DMA_END_CHAIN_TD 0xFF
+#define TD_INC_DST_ADR      0x04u
+
+extern dmac_tdmem_struct cyDmaTdMem[CY_DMA_NUMBEROF_TDS];
+#define CY_DMA_TDMEM_STRUCT_PTR cyDmaTdMem
+
+uint8 CyDmaTdAllocate(void);
+uint8 CyDmaTdSetConfiguration(uint8 tdHandle, uint16 transferCount, uint8 nextTd, uint8 configuration);
+uint8 CyDmaTdSetAddress(uint8 tdHandle, uint16 source, uint16 destination);
+uint8 CyDmaChSetInitialTd(uint8 chHandle, uint8 startTd);
+uint8 CyDmaChEnable(uint8 chHandle, uint8 preserveTds);
+uint8 CyDmaChStatus(uint8 chHandle, uint8 *currentTd, uint8 *state);
+#endif
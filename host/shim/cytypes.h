@@ -0,0 +1,38 @@
+/*
+    Host stand-in for the PSoC Creator generated cytypes.h, just enough
+    to build the firmware's portable modules on Linux. Not used on the
+    board.
+*/
+#ifndef CY_BOOT_CYTYPES_H
+#define CY_BOOT_CYTYPES_H
+
+#include <stdint.h>
+
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int8_t   int8;
+typedef int16_t  int16;
+typedef int32_t  int32;
+typedef int64_t  int64;
+typedef float    float32;
+typedef double   float64;
+typedef unsigned int uint;
+
+typedef volatile uint8  reg8;
+typedef volatile uint16 reg16;
+typedef volatile uint32 reg32;
+
+#define LO16(x) ((uint16)(uintptr_t)(x))
+#define HI16(x) ((uint16)((uintptr_t)(x) >> 16))
+
+#define CY_GET_REG16(addr) (*(reg16*)(addr))
+
+#define CY_ISR(FuncName) void FuncName(void)
+#define CY_ISR_PROTO(FuncName) void FuncName(void)
+typedef void (*cyisraddress)(void);
+
+#define CyGlobalIntEnable do {} while (0)
+#define CyGlobalIntDisable do {} while (0)
+#endif
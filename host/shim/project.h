@@ -0,0 +1,58 @@
+/*
+    Host stand-in for the PSoC Creator generated project.h. Declares the
+    component APIs the firmware calls; shim.c implements them as no-ops,
+    except for the XBee and PC UART output, which tests can capture.
+*/
+#ifndef CY_PROJECT_H
+#define CY_PROJECT_H
+
+#include <stdio.h>
+#include "cytypes.h"
+#include "cylib.h"
+
+// A UART component named _N, as the firmware uses them
+#define HOST_UART(_N) \
+    void   _N##_Start(void); \
+    void   _N##_PutChar(uint8 txDataByte); \
+    void   _N##_PutString(const char string[]); \
+    void   _N##_PutArray(const uint8 string[], uint8 byteCount); \
+    void   _N##_WriteTxData(uint8 txDataByte); \
+    uint8  _N##_ReadTxStatus(void); \
+    uint8  _N##_GetTxBufferSize(void); \
+    uint8  _N##_ReadRxData(void); \
+    uint8  _N##_GetRxBufferSize(void); \
+    uint16 _N##_GetChar(void); \
+    void   _N##_ClearRxBuffer(void); \
+    void   _N##_TX_SetDriveMode(uint8 mode); \
+    uint8  _N##_RX_DMA_DmaInitialize(uint8 burstCount, uint8 requestPerBurst, \
+                                     uint16 upperSrcAddress, uint16 upperDestAddress);
+
+HOST_UART(GPS)
+HOST_UART(XB)
+HOST_UART(PC)
+HOST_UART(TFT)
+
+#define GPS_TX_DM_STRONG    6u
+#define XB_TX_DM_STRONG     6u
+#define PC_TX_DM_STRONG     6u
+#define GPS_TX_STS_COMPLETE 0x01u
+#define XB_TX_BUFFER_SIZE   64u
+
+#define CYDEV_PERIPH_BASE 0x40000000u
+#define CYDEV_SRAM_BASE   0x1FFF8000u
+
+void GPS_CLK_Start(void);
+void GPS_CLK_SetDividerValue(uint16 clkDivider);
+void TFT_CLOCK_SetDividerValue(uint16 clkDivider);
+void TFT_RST_Control_Write(uint8 control);
+void Display_Refresh_Timer_Start(void);
+uint8 Display_Refresh_Timer_ReadStatusRegister(void);
+void Display_Refresh_StartEx(cyisraddress address);
+
+/*
+    Host only. Bytes the firmware puts in the XBee and PC UARTs' TX
+    buffers go to these, if set.
+*/
+extern void (*Host_XbTx)(const uint8 *data, uint16 len);
+extern void (*Host_PcTx)(const char *text);
+#endif
@@ -0,0 +1,79 @@
+#include "project.h"
+
+/*
+    The PSoC component APIs the firmware calls, for host builds. Nothing
+    is ever received, and the UARTs' TX buffers always have room, as if
+    they drained instantly.
+*/
+
+void (*Host_XbTx)(const uint8 *data, uint16 len);
+void (*Host_PcTx)(const char *text);
+
+#define HOST_UART_STUBS(_N) \
+    void   _N##_Start(void) {} \
+    void   _N##_WriteTxData(uint8 txDataByte) { _N##_PutChar(txDataByte); } \
+    uint8  _N##_ReadTxStatus(void) { return GPS_TX_STS_COMPLETE; } \
+    uint8  _N##_GetTxBufferSize(void) { return 0; } \
+    uint8  _N##_ReadRxData(void) { return 0; } \
+    uint8  _N##_GetRxBufferSize(void) { return 0; } \
+    uint16 _N##_GetChar(void) { return 0; } \
+    void   _N##_ClearRxBuffer(void) {} \
+    void   _N##_TX_SetDriveMode(uint8 mode) {} \
+    uint8  _N##_RX_DMA_DmaInitialize(uint8 burstCount, uint8 requestPerBurst, \
+                                     uint16 upperSrcAddress, uint16 upperDestAddress) { return 0; }
+
+HOST_UART_STUBS(GPS)
+HOST_UART_STUBS(XB)
+HOST_UART_STUBS(PC)
+HOST_UART_STUBS(TFT)
+
+void GPS_PutChar(uint8 txDataByte) {}
+void GPS_PutString(const char string[]) {}
+void GPS_PutArray(const uint8 string[], uint8 byteCount) {}
+void TFT_PutChar(uint8 txDataByte) {}
+void TFT_PutString(const char string[]) {}
+void TFT_PutArray(const uint8 string[], uint8 byteCount) {}
+
+void XB_PutArray(const uint8 string[], uint8 byteCount) {
+    if (Host_XbTx)
+        Host_XbTx(string, byteCount);
+}
+
+void XB_PutChar(uint8 txDataByte) {
+    XB_PutArray(&txDataByte, 1);
+}
+
+void XB_PutString(const char string[]) {
+    XB_PutArray((const uint8*)string, strlen(string));
+}
+
+void PC_PutString(const char string[]) {
+    if (Host_PcTx)
+        Host_PcTx(string);
+}
+
+void PC_PutChar(uint8 txDataByte) {
+    char s[2] = {txDataByte, 0};
+    
+    PC_PutString(s);
+}
+
+void PC_PutArray(const uint8 string[], uint8 byteCount) {
+    while (byteCount--)
+        PC_PutChar(*string++);
+}
+
+void GPS_CLK_Start(void) {}
+void GPS_CLK_SetDividerValue(uint16 clkDivider) {}
+void TFT_CLOCK_SetDividerValue(uint16 clkDivider) {}
+void TFT_RST_Control_Write(uint8 control) {}
+void Display_Refresh_Timer_Start(void) {}
+uint8 Display_Refresh_Timer_ReadStatusRegister(void) { return 0; }
+void Display_Refresh_StartEx(cyisraddress address) {}
+
+void CyDelay(uint32 milliseconds) {}
+void CyGetUniqueId(uint32 *uniqueId) { *uniqueId = 0x50494E50; }
+uint8 CyEnterCriticalSection(void) { return 0; }
+void CyExitCriticalSection(uint8 savedIntrStatus) {}
+void CySysTickStart(void) {}
+cyisraddress CySysTickSetCallback(uint32 number, cyisraddress function) { return NULL; }
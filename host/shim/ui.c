@@ -0,0 +1,14 @@
+#include "project.h"
+#include "xbee.h"
+
+/*
+    The display calls the radio code makes, for host builds that link
+    xbee.c without the screen. Nothing is drawn.
+*/
+
+void Disp_Refresh_Map() {}
+void Adafruit_RA8875_textMode(void) {}
+void Adafruit_RA8875_textSetCursor(uint16_t x, uint16_t y) {}
+void Adafruit_RA8875_textColor(uint16_t foreColor, uint16_t bgColor) {}
+void Adafruit_RA8875_textEnlarge(uint8_t scale) {}
+void Adafruit_RA8875_textWrite(const char* buffer, uint16_t len) {}
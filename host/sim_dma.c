@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include "sim_dma.h"
+
+dmac_tdmem_struct cyDmaTdMem[CY_DMA_NUMBEROF_TDS];
+SimDma_Channel simDma[SIM_DMA_CHANNELS];
+
+// Memory the TDs write to. Addresses are only 16 bits, as on the PSoC,
+// so they are matched against the low 16 bits of each region.
+#define SIM_DMA_REGIONS 4
+static struct {
+    uint8 *base;
+    uint16 len;
+} regions[SIM_DMA_REGIONS];
+static uint8 numRegions, numTds;
+
+void SimDma_Reset() {
+    memset(cyDmaTdMem, 0, sizeof(cyDmaTdMem));
+    memset(simDma, 0, sizeof(simDma));
+    numRegions = numTds = 0;
+}
+
+// Lets TDs write to the <len> bytes at <base>
+void SimDma_Map(void *base, uint16 len) {
+    regions[numRegions].base = base;
+    regions[numRegions++].len = len;
+}
+
+static uint16 tdCount(uint8 td) {
+    return (cyDmaTdMem[td].TD0[0] | cyDmaTdMem[td].TD0[1] << 8) & 0x0FFF;
+}
+
+static uint16 tdDest(uint8 td) {
+    return cyDmaTdMem[td].TD1[2] | cyDmaTdMem[td].TD1[3] << 8;
+}
+
+// One byte from the peripheral on channel <ch>
+void SimDma_Request(uint8 ch, uint8 byte) {
+    SimDma_Channel *c = &simDma[ch];
+    uint16 count, dest, off;
+    uint8 td = c->td, i;
+    
+    if (!c->enabled || td >= CY_DMA_NUMBEROF_TDS || !(count = tdCount(td))) {
+        ++c->numLost;
+        return;
+    }
+    dest = tdDest(td);
+    for (i = 0; i < numRegions; i++) {
+        off = dest - LO16(regions[i].base);
+        if (off < regions[i].len) {
+            regions[i].base[off] = byte;
+            break;
+        }
+    }
+    if (i == numRegions) {
+        fprintf(stderr, "sim_dma: TD %u writes to unmapped %04X\n", td, dest);
+        exit(1);
+    }
+    ++c->numBytes;
+    
+    --count;
+    cyDmaTdMem[td].TD0[0] = count;
+    cyDmaTdMem[td].TD0[1] = (cyDmaTdMem[td].TD0[1] & 0xF0) | count >> 8;
+    if (cyDmaTdMem[td].TD0[3] & TD_INC_DST_ADR) {
+        ++dest;
+        cyDmaTdMem[td].TD1[2] = dest;
+        cyDmaTdMem[td].TD1[3] = dest >> 8;
+    }
+    if (!count)
+        c->td = cyDmaTdMem[td].TD0[2];
+}
+
+uint8 CyDmaTdAllocate(void) {
+    return numTds < CY_DMA_NUMBEROF_TDS ? numTds++ : CY_DMA_DISABLED_TD;
+}
+
+uint8 CyDmaTdSetConfiguration(uint8 tdHandle, uint16 transferCount, uint8 nextTd, uint8 configuration) {
+    cyDmaTdMem[tdHandle].TD0[0] = transferCount;
+    cyDmaTdMem[tdHandle].TD0[1] = transferCount >> 8 & 0x0F;
+    cyDmaTdMem[tdHandle].TD0[2] = nextTd;
+    cyDmaTdMem[tdHandle].TD0[3] = configuration;
+    return 0;
+}
+
+uint8 CyDmaTdSetAddress(uint8 tdHandle, uint16 source, uint16 destination) {
+    cyDmaTdMem[tdHandle].TD1[0] = source;
+    cyDmaTdMem[tdHandle].TD1[1] = source >> 8;
+    cyDmaTdMem[tdHandle].TD1[2] = destination;
+    cyDmaTdMem[tdHandle].TD1[3] = destination >> 8;
+    return 0;
+}
+
+uint8 CyDmaChSetInitialTd(uint8 chHandle, uint8 startTd) {
+    simDma[chHandle].td = startTd;
+    return 0;
+}
+
+uint8 CyDmaChEnable(uint8 chHandle, uint8 preserveTds) {
+    simDma[chHandle].enabled = 1;
+    return 0;
+}
+
+uint8 CyDmaChStatus(uint8 chHandle, uint8 *currentTd, uint8 *state) {
+    if (currentTd)
+        *currentTd = simDma[chHandle].td;
+    if (state)
+        *state = simDma[chHandle].enabled;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __SIM_DMA_H
+#define __SIM_DMA_H
+
+#include <project.h>
+
+/*
+    Simulated PSoC DMA controller behind the CyDma* calls in the shim's
+    cylib.h, for testing dmarx.c. A request moves one byte into the
+    current TD's destination. TDs aren't preserved: the count in TD
+    memory goes down as bytes are written and the chain moves on to
+    the next TD at 0, so a TD has to be re-armed before the chain comes
+    back around to it. A channel that reaches a TD at 0 stays on it,
+    losing each byte requested, until the TD is re-armed.
+*/
+#define SIM_DMA_CHANNELS 4
+
+typedef struct SimDma_Channel {
+    uint8  enabled;
+    uint8  td; // Current TD
+    uint32 numBytes; // Written to memory
+    uint32 numLost; // Requests that found nothing armed
+} SimDma_Channel;
+
+extern SimDma_Channel simDma[SIM_DMA_CHANNELS];
+
+void SimDma_Reset();
+void SimDma_Map(void *base, uint16 len);
+void SimDma_Request(uint8 ch, uint8 byte);
+#endif
@@ -0,0 +1,476 @@
+#include <stdlib.h>
+#include "hostutil.h"
+#include "xbee.c" // For its statics, which are per node here
+
+/*
+    Simulates the relay layer over topologies wider than one radio's
+    range: a line, where everything past the next node has to be
+    relayed, and a dense grid, where most relays should be suppressed.
+    Every node runs xbee.c's receive path and XB_RelayService with its
+    own copy of the radio state, swapped in around each call. A node's
+    frames reach each neighbour whole and are never lost; collisions
+    are sim_slots' business. Both run without GPS time, where relays
+    wait out a random back-off, and then with it, where they wait for
+    the relay's slot.
+
+    Built for transparent mode, where what a node writes to its UART is
+    what its neighbours' framers get, and for API mode, where each
+    radio turns transmit requests into receive packets for the radios
+    in range, addressed or broadcast, and answers with a transmit
+    status.
+
+    Only one node sends messages, as sendMessage's msgID isn't swapped.
+*/
+
+volatile uint32 msTicks;
+
+extern User userPoolObjs[MAX_USERS];
+
+#define MAX_NODES 25
+
+typedef struct Node {
+    Self me;
+    XB_TxQueue tx;
+    XB_RxMessages rx;
+    XB_BeaconState beacon;
+    XB_RelayState relay;
+    MsgLog log;
+    Pool pool;
+    User poolObjs[MAX_USERS];
+    uint8 sinceAnnounce;
+    uint32 lastProbe;
+    Ring ring;
+    XBL_Frame ringSlots[sizeof(xbRingSlots) / sizeof(xbRingSlots[0])];
+    XBL_Framer framer;
+#if XB_API_MODE
+    Ring apiRing;
+    XBAPI_Frame apiRingSlots[sizeof(xbApiRingSlots) / sizeof(xbApiRingSlots[0])];
+    XBAPI_Framer apiFramer;
+#endif
+    uint8 out[8 * XB_TX_MAX]; // Written to the UART this millisecond
+    uint16 outLen;
+    uint16 numSent; // Link frames
+} Node;
+
+static Node nodes[MAX_NODES];
+static int numNodes;
+static uint8 inRange[MAX_NODES][MAX_NODES];
+static Node *cur; // Swapped in
+static Node fresh; // The receive path and pool as the firmware starts them
+
+static void nodeTx(const uint8 *data, uint16 len) {
+    CHECK(cur && cur->outLen + len <= sizeof(cur->out));
+    memcpy(cur->out + cur->outLen, data, len);
+    cur->outLen += len;
+}
+
+static void swapIn(Node *n) {
+    xbTx = n->tx;
+    xbRx = n->rx;
+    xbBeacon = n->beacon;
+    xbRelay = n->relay;
+    msgLog = n->log;
+    userPool = n->pool;
+    memcpy(userPoolObjs, n->poolObjs, sizeof(userPoolObjs));
+    beaconsSinceAnnounce = n->sinceAnnounce;
+    lastProbe = n->lastProbe;
+    xbRing = n->ring;
+    memcpy(xbRingSlots, n->ringSlots, sizeof(xbRingSlots));
+    xbFramer = n->framer;
+#if XB_API_MODE
+    xbApiRing = n->apiRing;
+    memcpy(xbApiRingSlots, n->apiRingSlots, sizeof(xbApiRingSlots));
+    xbApiFramer = n->apiFramer;
+#endif
+    cur = n;
+}
+
+static void swapOut() {
+    Node *n = cur;
+
+    n->tx = xbTx;
+    n->rx = xbRx;
+    n->beacon = xbBeacon;
+    n->relay = xbRelay;
+    n->log = msgLog;
+    n->pool = userPool;
+    memcpy(n->poolObjs, userPoolObjs, sizeof(userPoolObjs));
+    n->sinceAnnounce = beaconsSinceAnnounce;
+    n->lastProbe = lastProbe;
+    n->ring = xbRing;
+    memcpy(n->ringSlots, xbRingSlots, sizeof(xbRingSlots));
+    n->framer = xbFramer;
+#if XB_API_MODE
+    n->apiRing = xbApiRing;
+    memcpy(n->apiRingSlots, xbApiRingSlots, sizeof(xbApiRingSlots));
+    n->apiFramer = xbApiFramer;
+#endif
+    cur = NULL;
+}
+
+static uint32 nodeId(int i) {
+    return 0x50494E00UL + i * 0x01010101UL;
+}
+
+/*
+    Resets the network to <n> nodes, none in range of each other. With
+    <slotted>, they all have GPS time, from msTicks 0.
+*/
+static void reset(int n, int slotted) {
+    int i;
+
+    memset(nodes, 0, sizeof(nodes));
+    memset(inRange, 0, sizeof(inRange));
+    numNodes = n;
+    msTicks = 0;
+    memset(&gpsClock, 0, sizeof(gpsClock));
+    if (slotted)
+        GPS_SyncClock(0, 0);
+    srand(1);
+    for (i = 0; i < n; i++) {
+        Node *node = &nodes[i];
+
+        *node = fresh;
+        node->sinceAnnounce = XB_ANNOUNCE_EVERY;
+        node->me.id = nodeId(i);
+        sprintf(node->me.name, "Node %d", i);
+        swapIn(node);
+        XB_BeaconInit(&node->me);
+        swapOut();
+    }
+}
+
+static void addLink(int a, int b) {
+    inRange[a][b] = inRange[b][a] = 1;
+}
+
+// <len> bytes from the radio to the swapped in node, each followed by
+// a pass of its main loop
+static void nodeRx(const uint8 *data, uint16 len) {
+    uint16 i;
+
+    for (i = 0; i < len; i++) {
+        XB_RxByte(data[i]);
+        XB_RxService(&cur->me);
+    }
+}
+
+// Counts the link frames in <len> bytes of what node <n> sent
+static void countSent(Node *n, const uint8 *data, uint16 len) {
+    static XBL_Frame frame;
+    static XBL_Framer fr = {&frame, XB_PAYLOAD_MAX, XB_NUM_TYPES};
+    uint16 i;
+
+    for (i = 0; i < len; i++)
+        n->numSent += XBL_Feed(&fr, data[i]) != NULL;
+}
+
+#if XB_API_MODE
+static void nodeAddr(int i, uint8 *addr) {
+    uint32 id = nodeId(i);
+    uint8 j;
+
+    addr[0] = 0x00;
+    addr[1] = 0x13;
+    addr[2] = 0xA2;
+    addr[3] = 0x00;
+    for (j = 0; j < 4; j++)
+        addr[4 + j] = id >> (24 - 8 * j);
+}
+
+/*
+    Node <i>'s radio acting on what the node wrote to it: each transmit
+    request goes to every node in range if it is a broadcast and
+    otherwise only to the one it is addressed to, as a receive packet
+    in <rx>. A transmit status goes back to the node itself. AT
+    commands are dropped.
+*/
+static void radioTx(int i, const uint8 *data, uint16 len, uint8 rx[][MAX_NODES * sizeof(nodes[0].out)],
+                    uint16 *rxLen) {
+    static const uint8 broadcast[8] = {0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+    uint8 pkt[XBAPI_MAX_DATA] = {XBAPI_RX_PACKET}, dest[8];
+    const uint8 *a;
+    uint16 pos, n, rf;
+    int j;
+
+    for (pos = 0; pos < len; pos += XBAPI_OVERHEAD + n) {
+        CHECK(len - pos > XBAPI_OVERHEAD && data[pos] == XBAPI_START); // Whole frames, unescaped
+        n = data[pos + 1] << 8 | data[pos + 2];
+        a = data + pos + 3;
+        if (a[0] != XBAPI_TX_REQUEST)
+            continue;
+        rf = n - XBAPI_TX_HEADER;
+        countSent(&nodes[i], a + XBAPI_TX_HEADER, rf);
+        nodeAddr(i, pkt + 1);
+        pkt[9] = 0xFF;
+        pkt[10] = 0xFE;
+        pkt[11] = memcmp(a + 2, broadcast, 8) ? 0x01 : 0x02; // Acknowledged or broadcast
+        memcpy(pkt + XBAPI_RX_HEADER, a + XBAPI_TX_HEADER, rf);
+        for (j = 0; j < numNodes; j++) {
+            nodeAddr(j, dest);
+            if (inRange[i][j] && (pkt[11] == 0x02 || !memcmp(a + 2, dest, 8)))
+                rxLen[j] += XBAPI_Encode(rx[j] + rxLen[j], pkt, XBAPI_RX_HEADER + rf);
+        }
+        if (a[1]) {
+            uint8 status[7] = {XBAPI_TX_STATUS, a[1], 0xFF, 0xFE, 0, 0, 0};
+
+            rxLen[i] += XBAPI_Encode(rx[i] + rxLen[i], status, sizeof(status));
+        }
+    }
+}
+#endif
+
+// Runs every node's main loop for <ms> milliseconds
+static void run(uint32 ms) {
+    static uint8 rx[MAX_NODES][MAX_NODES * sizeof(nodes[0].out)];
+    uint16 rxLen[MAX_NODES], relayed;
+    uint32 end = msTicks + ms;
+    int i, j, k;
+
+    for (; msTicks != end; msTicks++) {
+        memset(rxLen, 0, sizeof(rxLen));
+        for (i = 0; i < numNodes; i++) {
+            swapIn(&nodes[i]);
+            relayed = xbRelay.numRelayed;
+            XB_RelayService(&nodes[i].me, msTicks);
+            if (xbRelay.numRelayed != relayed)
+                CHECK(inSlot(msTicks)); // Always true without GPS time
+            for (k = 0; k < 100 && (xbTx.cur || XB_TxDepth()); k++)
+                XB_TxPump();
+            swapOut();
+#if XB_API_MODE
+            radioTx(i, nodes[i].out, nodes[i].outLen, rx, rxLen);
+#else
+            countSent(&nodes[i], nodes[i].out, nodes[i].outLen);
+            for (j = 0; j < numNodes; j++) {
+                if (inRange[i][j]) {
+                    memcpy(rx[j] + rxLen[j], nodes[i].out, nodes[i].outLen);
+                    rxLen[j] += nodes[i].outLen;
+                }
+            }
+#endif
+            nodes[i].outLen = 0;
+        }
+        // What the receivers send in reply goes out next time round
+        for (j = 0; j < numNodes; j++) {
+            if (!rxLen[j])
+                continue;
+            swapIn(&nodes[j]);
+            nodeRx(rx[j], rxLen[j]);
+            swapOut();
+        }
+    }
+}
+
+static void announce(int i) {
+    swapIn(&nodes[i]);
+    beaconsSinceAnnounce = XB_ANNOUNCE_EVERY;
+    broadcastPosition(&nodes[i].me);
+    swapOut();
+}
+
+// Whether node <i> has heard node <j>'s announce
+static User *knows(int i, int j) {
+    User *u;
+
+    swapIn(&nodes[i]);
+    u = findUser(&nodes[i].me.users, nodeId(j), 0);
+    if (u && strcmp(u->name, nodes[j].me.name))
+        u = NULL;
+    swapOut();
+    return u;
+}
+
+static int totalSent() {
+    int i, n = 0;
+
+    for (i = 0; i < numNodes; i++)
+        n += nodes[i].numSent;
+    return n;
+}
+
+/*
+    A line of nodes, each only in range of the next. An announce and a
+    message from one end reach XB_RELAY_HOPS nodes along, relayed once
+    by each node in between, and no further. In slots each hop can take
+    up to a superframe.
+*/
+static void testLine(int slotted) {
+    const char *mode = slotted ? "slotted" : "back-off";
+    uint32 wait = slotted ? (XB_RELAY_HOPS + 1) * XB_SUPERFRAME : 1000;
+    char text[201];
+    MsgIter it = {0};
+    MsgRecord *r;
+    User *u;
+    int i, before, far = XB_RELAY_HOPS;
+
+    reset(far + 2, slotted);
+    for (i = 0; i + 1 < numNodes; i++)
+        addLink(i, i + 1);
+
+    announce(0);
+    run(wait);
+    for (i = 1; i <= far; i++)
+        CHECK(knows(i, 0));
+    CHECK(!knows(far + 1, 0));
+    for (i = 0; i < numNodes; i++)
+        CHECK(nodes[i].numSent == (i < far)); // Sent once, relayed by each in between
+    printf("line, %s: announce from node 0 reached nodes 1-%d, %d transmissions\n",
+           mode, far, totalSent());
+
+    // A message to the far end, after hearing it announce
+    announce(far);
+    run(wait);
+    CHECK(knows(0, far));
+    for (i = 0; i < 200; i++)
+        text[i] = 'A' + i % 26;
+    text[200] = '\0';
+    swapIn(&nodes[0]);
+    memcpy(nodes[0].me.draft.msg, text, sizeof(text));
+    nodes[0].me.draft.msgLen = 200;
+    CHECK(sendMessage(&nodes[0].me, findUser(&nodes[0].me.users, nodeId(far), 0)));
+    swapOut();
+    before = totalSent();
+    run(wait);
+
+    // Each fragment sent by node 0 and relayed by the nodes between,
+    // but not by the one it is for
+    CHECK(totalSent() - before == 3 * far);
+    CHECK(nodes[far].numSent == 1); // Its own announce only
+    swapIn(&nodes[far]);
+    u = findUser(&nodes[far].me.users, nodeId(0), 0);
+    CHECK(u && u->numMsgs == 1);
+    CHECK((r = nextMessage(u, &it)) && !r->sent);
+    CHECK(r->len == 200 && !memcmp(r->text, text, 200));
+    swapOut();
+    for (i = 1; i < far; i++) {
+        swapIn(&nodes[i]);
+        u = findUser(&nodes[i].me.users, nodeId(0), 0);
+        CHECK(u && u->numMsgs == 0);
+        swapOut();
+    }
+    printf("line, %s: 3 fragment message from node 0 delivered %d hops away, "
+           "%d transmissions\n", mode, far, totalSent() - before);
+}
+
+/*
+    A grid where every node hears the eight around it. An announce from
+    a corner reaches every node within XB_RELAY_HOPS, each keeps one
+    copy, and nodes that hear others relay it first hold back, so
+    well under every node transmits. In slots, relays go out in slot
+    order rather than hop order, and those held back may leave the far
+    edge only copies that have come the long way round, so that grid
+    is a node smaller.
+*/
+static void testGrid(int slotted) {
+    const int side = XB_RELAY_HOPS + !slotted;
+    uint32 wait = slotted ? (XB_RELAY_HOPS + 1) * XB_SUPERFRAME : 1000;
+    int x, y, dx, dy, i, relayed = 0, suppressed = 0;
+
+    reset(side * side, slotted);
+    for (y = 0; y < side; y++)
+        for (x = 0; x < side; x++)
+            for (dy = 0; dy <= 1; dy++)
+                for (dx = -1; dx <= 1; dx++) {
+                    if ((dy || dx > 0) && x + dx >= 0 && x + dx < side && y + dy < side)
+                        addLink(y * side + x, (y + dy) * side + x + dx);
+                }
+
+    announce(0);
+    run(wait);
+    for (i = 1; i < numNodes; i++) {
+        CHECK(knows(i, 0));
+        CHECK(nodes[i].numSent <= 1 + slotted); // Again for a copy with more hops left
+        relayed += nodes[i].relay.numRelayed;
+        suppressed += nodes[i].relay.numSuppressed;
+        CHECK(nodes[i].relay.numDropped == 0);
+    }
+    CHECK(relayed == totalSent() - 1);
+    CHECK(relayed + suppressed <= numNodes - 1);
+    CHECK(suppressed > 0);
+    CHECK(relayed < (numNodes - 1) * 2 / 3);
+    printf("grid, %s: announce from a corner of %dx%d reached all %d nodes, "
+           "%d relayed and %d held back\n", slotted ? "slotted" : "back-off",
+           side, side, numNodes - 1, relayed, suppressed);
+}
+
+static int seen(uint16 origin, uint8 seq, uint8 ttl) {
+    XBEE_Relay r = {origin, seq, ttl};
+
+    return seenFrame(&r);
+}
+
+// The per origin table of seqs already handled
+static void testSeen() {
+    XBL_Frame f = {0};
+    XBEE_Relay *p = (XBEE_Relay*)xbRelay.pending[0].data;
+    int i;
+
+    memset(&xbRelay, 0, sizeof(xbRelay));
+    msTicks = 1;
+
+    // Across the wrap, and out of order within the window
+    CHECK(seen(1, 250, 2) == 0);
+    CHECK(seen(1, 250, 2) == 1);
+    for (i = 251; i <= 257; i++)
+        CHECK(seen(1, i, 2) == 0);
+    CHECK(seen(1, 250, 2) == 1);
+    CHECK(seen(1, 3, 2) == 0);
+    CHECK(seen(1, 2, 2) == 0);
+    CHECK(seen(1, 2, 2) == 1);
+    CHECK(seen(1, 3 - 31, 2) == 0);
+    CHECK(seen(1, 3 - 32, 2) == 1); // Too old to tell, so a stale copy
+
+    // Not heard from in a while, as after a reboot
+    msTicks += XB_SEEN_TIMEOUT + 1;
+    CHECK(seen(1, 2, 2) == 0);
+    CHECK(seen(1, 2, 2) == 1);
+
+    // A full table forgets the origin heard from longest ago
+    for (i = 2; i <= XB_SEEN_ORIGINS; i++, msTicks++)
+        CHECK(seen(i, 7, 2) == 0);
+    CHECK(xbRelay.numSeen == XB_SEEN_ORIGINS);
+    CHECK(seen(1, 3, 2) == 0); // Heard since 2
+    CHECK(seen(XB_SEEN_ORIGINS + 1, 7, 2) == 0);
+    CHECK(seen(2, 7, 2) == 0);
+    CHECK(seen(1, 2, 2) == 1);
+
+    // A copy of the newest with more hops left is passed on again, and
+    // raises a relay still waiting instead
+    CHECK(seen(100, 5, 2) == 0);
+    CHECK(seen(100, 5, 4) == 2);
+    CHECK(seen(100, 5, 4) == 1);
+    CHECK(seen(100, 4, 4) == 0);
+    CHECK(seen(100, 4, 4) == 1);
+    f.type = POSITION;
+    f.len = sizeof(XBEE_Relay) + sizeof(XBEE_Beacon);
+    ((XBEE_Relay*)f.data)->origin = 101;
+    ((XBEE_Relay*)f.data)->ttl = 2;
+    CHECK(seen(101, 0, 2) == 0);
+    queueRelay(&f);
+    CHECK(p->ttl == 1);
+    CHECK(seen(101, 0, 1) == 1 && xbRelay.pending[0].dups == 1);
+    CHECK(seen(101, 0, 4) == 1);
+    CHECK(p->ttl == 3 && xbRelay.pending[0].dups == 2);
+    memset(&xbRelay, 0, sizeof(xbRelay));
+}
+
+int main() {
+    int slotted;
+
+    Host_XbTx = nodeTx;
+    fresh.pool = userPool;
+    fresh.ring = xbRing;
+    fresh.framer = xbFramer;
+#if XB_API_MODE
+    fresh.apiRing = xbApiRing;
+    fresh.apiFramer = xbApiFramer;
+#endif
+    testSeen();
+    for (slotted = 0; slotted < 2; slotted++) {
+        testLine(slotted);
+        testGrid(slotted);
+    }
+    printf("sim_relay (API mode %d): %d checks passed\n", XB_API_MODE, numChecks);
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include "hostutil.h"
+#include "xbee.c" // For pickSlot, slotHeard and inSlot
+#include "replay.h"
+
+/*
+    Simulates a group of nodes sharing one channel, all in range of each
+    other, to show the beacon slots settle. Each node keeps its own
+    XB_BeaconState, swapped in around the calls into xbee.c.
+
+    Every superframe each node sends a beacon in its slot with
+    probability SEND_PERCENT. The skipped checks stand in for needBeacon
+    when the dead reckoning holds. Every beacon heard is also queued to
+    be relayed as logXBdata does, and XB_RelayService is run for every
+    node at the start of every slot, so relays must only come out in
+    the relaying node's own slot. A slot with one sender is heard by
+    every node not sending. A slot with more than one is lost to
+    everyone, and so are the senders' own slots, as the radios are half
+    duplex. Collisions are only found out when one of the pair stays
+    quiet while the other sends, as on the air.
+
+    The same traffic is also run unslotted, each beacon at a random
+    point in the superframe, lost if another overlaps it. That is the
+    old fixed-period timer at arbitrary phase.
+
+    First, the GPS clock the slots hang off is checked against RMCs
+    fed through the framer a character per millisecond.
+
+    sim_slots [nodes...]
+*/
+
+volatile uint32 msTicks;
+
+#define SUPERFRAMES  600 // Ten minutes
+#define SETTLED      300 // Superframes before delivery is measured
+#define SEND_PERCENT 50
+#define AIRTIME      (XB_SLOT_MS - XB_SLOT_GUARD) // Longest beacon that fits a slot
+
+typedef struct Node {
+    Self me;
+    XB_BeaconState beacon;
+    XB_RelayState relay;
+    uint8 sending;
+    uint16 start; // Unslotted, ms into the superframe
+    XBL_Frame out[1 + XB_RELAY_PENDING]; // Sent in the current slot
+    uint8 numOut;
+} Node;
+
+static Node nodes[100];
+
+typedef struct Result {
+    uint32 sent, heard; // Beacons, and beacons heard by everyone else
+    uint32 relaySent, relayHeard; // The same for relays
+    int    shared; // Nodes left sharing a slot at the end
+    uint16 collisions; // Times nodes were moved
+} Result;
+
+// Node <j> hearing <f>, handled as logXBdata does
+static void hear(int j, XBL_Frame *f) {
+    XBEE_Relay *rl = (XBEE_Relay*)f->data;
+    int seen;
+
+    xbBeacon = nodes[j].beacon;
+    xbRelay = nodes[j].relay;
+    if (rl->origin != shortID(nodes[j].me.id) && (seen = seenFrame(rl)) != 1) {
+        if (rl->ttl > 1)
+            queueRelay(f);
+        if (!seen && rl->ttl == XB_RELAY_HOPS)
+            slotHeard(&nodes[j].me, (XBEE_Beacon*)(rl + 1));
+    }
+    nodes[j].beacon = xbBeacon;
+    nodes[j].relay = xbRelay;
+}
+
+// Puts what node <i> sends at the start of <slot> in its out frames
+static void send(int i, int slot) {
+    Node *node = &nodes[i];
+    XBL_Frame *f = node->out;
+    XBEE_Relay *rl = (XBEE_Relay*)f->data;
+    XBEE_Beacon *b = (XBEE_Beacon*)(rl + 1);
+    XB_Relayed pending[XB_RELAY_PENDING];
+    uint16 relayed;
+    int k, beacon = node->sending && node->beacon.slot == slot;
+
+    node->numOut = 0;
+    if (beacon) {
+        memset(f, 0, sizeof(*f));
+        f->type = POSITION;
+        f->len = sizeof(XBEE_Relay) + sizeof(XBEE_Beacon);
+        rl->origin = shortID(node->me.id);
+        rl->seq = ++node->relay.seq;
+        rl->ttl = XB_RELAY_HOPS;
+        b->shortID = rl->origin;
+        b->slot = slot;
+        ++node->numOut;
+    }
+
+    // The pending relays XB_RelayService empties without holding back
+    // are the ones sent
+    memset(&xbTx, 0, sizeof(xbTx));
+    xbBeacon = node->beacon;
+    xbRelay = node->relay;
+    memcpy(pending, xbRelay.pending, sizeof(pending));
+    relayed = xbRelay.numRelayed;
+    XB_RelayService(&node->me, msTicks);
+    for (k = 0; k < XB_RELAY_PENDING; k++) {
+        if (!pending[k].len || xbRelay.pending[k].len || pending[k].dups >= XB_RELAY_DUPS)
+            continue;
+        f = &node->out[node->numOut++];
+        f->type = pending[k].type;
+        f->len = pending[k].len;
+        memcpy(f->data, pending[k].data, f->len);
+    }
+    if (node->numOut > beacon || xbRelay.numRelayed != relayed) {
+        CHECK(xbRelay.numRelayed - relayed == node->numOut - beacon);
+        CHECK(node->beacon.slot == slot);
+    }
+    node->relay = xbRelay;
+}
+
+static void runSlotted(int n, Result *r) {
+    int sf, i, j, k, slot, senders, count[XB_NUM_SLOTS];
+
+    memset(r, 0, sizeof(*r));
+    msTicks = 0;
+    for (i = 0; i < n; i++) {
+        memset(&nodes[i], 0, sizeof(nodes[i]));
+        nodes[i].me.id = (uint32)rand() << 16 ^ rand();
+        XB_BeaconInit(&nodes[i].me);
+        nodes[i].beacon = xbBeacon;
+    }
+
+    for (sf = 0; sf < SUPERFRAMES; sf++) {
+        msTicks = sf * XB_SUPERFRAME;
+        GPS_SyncClock(msTicks % 86400000UL, msTicks);
+        for (i = 0; i < n; i++)
+            nodes[i].sending = rand() % 100 < SEND_PERCENT;
+        for (slot = 0; slot < XB_NUM_SLOTS; slot++) {
+            msTicks = sf * XB_SUPERFRAME + slot * XB_SLOT_MS;
+            senders = 0;
+            for (i = 0; i < n; i++) {
+                send(i, slot);
+                senders += nodes[i].numOut > 0;
+            }
+            for (i = 0; i < n; i++) {
+                for (k = 0; k < nodes[i].numOut; k++) {
+                    XBEE_Relay *rl = (XBEE_Relay*)nodes[i].out[k].data;
+                    int relay = rl->ttl < XB_RELAY_HOPS;
+
+                    if (sf >= SETTLED) {
+                        r->sent += !relay;
+                        r->relaySent += relay;
+                    }
+                    if (senders > 1)
+                        continue;
+                    if (sf >= SETTLED) {
+                        r->heard += !relay;
+                        r->relayHeard += relay;
+                    }
+                    for (j = 0; j < n; j++)
+                        if (j != i)
+                            hear(j, &nodes[i].out[k]);
+                }
+            }
+        }
+    }
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+        ++count[nodes[i].beacon.slot];
+        r->collisions += nodes[i].beacon.numCollisions;
+    }
+    for (i = 0; i < n; i++)
+        if (count[nodes[i].beacon.slot] > 1)
+            ++r->shared;
+}
+
+static void runUnslotted(int n, Result *r) {
+    int sf, i, j, d;
+
+    memset(r, 0, sizeof(*r));
+    for (sf = SETTLED; sf < SUPERFRAMES; sf++) {
+        for (i = 0; i < n; i++) {
+            nodes[i].sending = rand() % 100 < SEND_PERCENT;
+            nodes[i].start = rand() % XB_SUPERFRAME;
+        }
+        for (i = 0; i < n; i++) {
+            if (!nodes[i].sending)
+                continue;
+            ++r->sent;
+            for (j = 0; j < n; j++) {
+                d = abs(nodes[i].start - nodes[j].start);
+                if (j != i && nodes[j].sending
+                    && (d < AIRTIME || XB_SUPERFRAME - d < AIRTIME))
+                    break;
+            }
+            r->heard += j == n;
+        }
+    }
+}
+
+// Feeds "$<body>*XX\r\n" to <fr> a character a millisecond
+static NMEA_Sentence *feedRmc(NMEA_Framer *fr, const char *body) {
+    char text[NMEA_MAX_LEN];
+    NMEA_Sentence *s = NULL;
+    uint8 checksum = 0;
+    const char *p;
+
+    for (p = body; *p; p++)
+        checksum ^= *p;
+    sprintf(text, "$%s*%02X\r\n", body, checksum);
+    for (p = text; *p; p++, msTicks++)
+        s = feedNMEA(fr, *p);
+    CHECK(s);
+    return s;
+}
+
+/*
+    Runs RMCs through the framer and on to GPS_SyncClock as logGPSdata
+    in main.c does. The clock must be synced to when the '$' arrived,
+    however long the main loop then takes to get to the sentence, and
+    left alone by a replayed log.
+*/
+static void testSync() {
+    static NMEA_Sentence buf;
+    NMEA_Framer fr = {&buf, &msTicks};
+    char info[100];
+    RMC_Str *rmc = (RMC_Str*)info;
+    NMEA_Sentence *s;
+    uint32 dollar, utc;
+
+    msTicks = 5000;
+    dollar = msTicks;
+    s = feedRmc(&fr, "GPRMC,123519.250,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W");
+    CHECK(s->at == dollar);
+    msTicks += 250; // The main loop was busy
+    CHECK(parseNMEA(s, info) == RMC);
+    CHECK(rmc->status == 'A');
+    CHECK(rmc->utc == 45319250);
+    GPS_SyncClock(rmc->utc, s->at);
+    CHECK(GPS_Time(msTicks, &utc));
+    CHECK(utc == rmc->utc + (msTicks - dollar));
+
+    // Slot 3 of the superframe opens 750 ms after the fix
+    xbBeacon.slot = 3;
+    CHECK(!inSlot(dollar + 749 + 3 * XB_SLOT_MS));
+    CHECK(inSlot(dollar + 750 + 3 * XB_SLOT_MS));
+    CHECK(!inSlot(dollar + 750 + 4 * XB_SLOT_MS - XB_SLOT_GUARD));
+
+    // A log being replayed is in the past, and doesn't move the clock
+    replay.mode = REPLAY_1X;
+    s = feedRmc(&fr, "GPRMC,000001.000,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W");
+    CHECK(parseNMEA(s, info) == RMC);
+    GPS_SyncClock(rmc->utc, s->at);
+    CHECK(GPS_Time(msTicks, &utc));
+    CHECK(utc == 45319250 + (msTicks - dollar));
+    replay.mode = REPLAY_OFF;
+    CHECK(!GPS_Time(dollar + GPS_CLOCK_HOLDOVER + 1, &utc));
+    memset(&gpsClock, 0, sizeof(gpsClock));
+}
+
+int main(int argc, char **argv) {
+    static const int defaults[] = {2, 5, 10, 15, 20, 25, 30, 31, 40};
+    int numRuns = argc > 1 ? argc - 1 : sizeof(defaults) / sizeof(defaults[0]);
+    int i, n;
+    Result slotted, aloha;
+
+    // Nodes must pick the slots the 32-bit board would
+    for (i = 0; i < 1000; i++) {
+        uint32 id = (uint32)rand() << 16 ^ rand(), salt = i % 256;
+        uint32 h = (uint32)(id ^ (uint32)(salt * 0x9E3779B9u)) * 2654435761u;
+        
+        CHECK(pickSlot(id, salt) == (h >> 16) % XB_NUM_SLOTS);
+    }
+    testSync();
+
+    srand(1);
+    printf("%d slots of %d ms, beacons in %d%% of superframes, measured over the last %d\n",
+           XB_NUM_SLOTS, XB_SLOT_MS, SEND_PERCENT, SUPERFRAMES - SETTLED);
+    printf("nodes  unslotted heard/s  slotted heard/s  sharing  moves  relays heard/s\n");
+    for (i = 0; i < numRuns; i++) {
+        n = argc > 1 ? atoi(argv[i + 1]) : defaults[i];
+        if (n < 1 || n > (int)(sizeof(nodes) / sizeof(nodes[0])))
+            continue;
+        runSlotted(n, &slotted);
+        runUnslotted(n, &aloha);
+        printf("%5d  %7.2f (%3u%%)   %7.2f (%3u%%)  %7d  %5u  %7.2f (%3u%%)\n", n,
+               (double)aloha.heard / (SUPERFRAMES - SETTLED), aloha.heard * 100 / aloha.sent,
+               (double)slotted.heard / (SUPERFRAMES - SETTLED),
+               slotted.heard * 100 / slotted.sent, slotted.shared, slotted.collisions,
+               (double)slotted.relayHeard / (SUPERFRAMES - SETTLED),
+               slotted.relaySent ? slotted.relayHeard * 100 / slotted.relaySent : 100);
+
+        // With a slot each, everyone settles and every beacon and relay
+        // gets through, so throughput goes up with the number of nodes
+        if (n <= XB_NUM_SLOTS) {
+            CHECK(slotted.shared == 0);
+            CHECK(slotted.heard == slotted.sent);
+            CHECK(slotted.relayHeard == slotted.relaySent);
+        }
+        // Past that it degrades, but never below sending at random
+        CHECK((uint64)slotted.heard * aloha.sent >= (uint64)aloha.heard * slotted.sent);
+    }
+    printf("sim_slots: %d checks passed\n", numChecks);
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include "hostutil.h"
+#include "sim_dma.h"
+#include "dmarx.h"
+#include "nmea.h"
+#include "xblink.h"
+
+/*
+    Runs DMARx_Read against the simulated DMA controller. The NMEA
+    corpus and a stream of link frames go in a byte at a time through
+    the DMA, as from the UARTs, and out through DMARx_Read to the
+    framers, which must see exactly what they would have been fed
+    directly. Reads come after bursts of up to half a buffer, the most
+    DMARx_Read allows, with no overruns. Then the reader is held off
+    for longer than that, and the framers must pick up again cleanly.
+    Last, DMARx_Flush must drop exactly what has been received.
+
+    test_dmarx corpus.nmea...
+*/
+
+#define CH 0
+
+static DMA_Rx rx;
+static reg8 rxData;
+
+// Hash of a sentence's fields, so the two paths can be compared
+static uint32 sentenceHash(NMEA_Sentence *s) {
+    uint32 h = 2166136261u;
+    const char *p;
+    int i;
+    
+    for (i = 0; i < s->numFields; i++)
+        for (p = NMEA_FIELD(s, i); ; p++) {
+            h = (h ^ (uint8)*p) * 16777619u;
+            if (!*p)
+                break;
+        }
+    return h;
+}
+
+static void start() {
+    SimDma_Reset();
+    SimDma_Map(rx.buf, sizeof(rx.buf));
+    DMARx_Start(&rx, CH, &rxData);
+}
+
+/*
+    Sends <len> bytes through the DMA, reading after every burst of up
+    to <maxBurst> bytes, or only once at the end if <stallAt> is in the
+    stream. Appends the hash of each sentence that comes out to <out>.
+*/
+static size_t streamNMEA(const char *text, size_t len, int maxBurst, size_t stallAt,
+                         uint32 *out) {
+    NMEA_Sentence s;
+    NMEA_Framer fr = {&s};
+    size_t i = 0, n = 0, burst;
+    uint8 c;
+    
+    while (i < len) {
+        burst = rand() % maxBurst + 1;
+        if (i <= stallAt && stallAt < i + burst)
+            burst = 5 * DMARX_LEN;
+        for (; burst && i < len; burst--)
+            SimDma_Request(CH, text[i++]);
+        while (DMARx_Read(&rx, &c))
+            if (feedNMEA(&fr, c))
+                out[n++] = sentenceHash(&s);
+    }
+    return n;
+}
+
+static void testNMEA(Corpus *corpus) {
+    uint32 *direct = malloc(corpus->len * sizeof(uint32));
+    uint32 *viaDma = malloc(corpus->len * sizeof(uint32));
+    NMEA_Sentence s;
+    NMEA_Framer fr = {&s};
+    size_t numDirect = 0, n, i;
+    
+    for (i = 0; i < corpus->len; i++)
+        if (feedNMEA(&fr, corpus->text[i]))
+            direct[numDirect++] = sentenceHash(&s);
+    CHECK(numDirect > 1000);
+    
+    // Up to the limit, every byte gets through in order
+    start();
+    n = streamNMEA(corpus->text, corpus->len, DMARX_HALF, (size_t)-1, viaDma);
+    CHECK(n == numDirect);
+    CHECK(!memcmp(viaDma, direct, n * sizeof(uint32)));
+    CHECK(rx.numLaps == 0);
+    CHECK(simDma[CH].numLost == 0);
+    CHECK(simDma[CH].numBytes == corpus->len);
+    
+    // Held off halfway through, the reader loses a stretch and then
+    // gets every sentence after it
+    start();
+    n = streamNMEA(corpus->text, corpus->len, DMARX_HALF, corpus->len / 2, viaDma);
+    CHECK(rx.numLaps == 1);
+    CHECK(simDma[CH].numLost > 0);
+    CHECK(n < numDirect);
+    CHECK(n > numDirect / 2);
+    CHECK(!memcmp(viaDma + n - numDirect / 4, direct + numDirect - numDirect / 4,
+                  numDirect / 4 * sizeof(uint32)));
+    free(direct);
+    free(viaDma);
+}
+
+static void testLink() {
+    static uint8 stream[64 * XBL_ENCODED_MAX], payload[64][XBL_MAX_LEN];
+    static uint16 len[64];
+    XBL_Frame f;
+    XBL_Framer fr;
+    size_t streamLen = 0, i = 0, burst, numFrames = 0;
+    int j, k;
+    uint8 c;
+    
+    for (j = 0; j < 64; j++) {
+        len[j] = rand() % (j % 8 ? 40 : XBL_MAX_LEN + 1);
+        for (k = 0; k < len[j]; k++)
+            payload[j][k] = j == 5 ? XBL_START : rand();
+        streamLen += XBL_Encode(stream + streamLen, j, payload[j], len[j]);
+        stream[streamLen++] = rand(); // Line noise between frames
+    }
+    
+    for (j = 0; j < 2; j++) {
+        start();
+        memset(&fr, 0, sizeof(fr));
+        fr.f = &f;
+        fr.maxLen = XBL_MAX_LEN;
+        fr.numTypes = 64;
+        numFrames = 0;
+        for (i = 0; i < streamLen; ) {
+            burst = rand() % DMARX_HALF + 1;
+            // The second time round, miss a whole buffer and more
+            if (j && i <= streamLen / 3 && streamLen / 3 < i + burst)
+                burst = 3 * DMARX_LEN;
+            for (; burst && i < streamLen; burst--)
+                SimDma_Request(CH, stream[i++]);
+            while (DMARx_Read(&rx, &c)) {
+                if (!XBL_Feed(&fr, c))
+                    continue;
+                CHECK(f.type < 64);
+                CHECK(f.len == len[f.type]);
+                CHECK(!memcmp(f.data, payload[f.type], f.len));
+                ++numFrames;
+            }
+        }
+        if (!j) {
+            CHECK(numFrames == 64);
+            CHECK(rx.numLaps == 0);
+            CHECK(fr.numBadCrc == 0);
+        }
+        else {
+            CHECK(rx.numLaps == 1);
+            CHECK(numFrames < 64);
+            CHECK(numFrames > 32);
+            CHECK(f.type == 63);
+        }
+    }
+}
+
+// A flush, as on a GPS baud change, drops what came before it, however
+// far round the buffer that was, and only that
+static void testFlush() {
+    int i, n;
+    uint8 c;
+
+    start();
+    for (n = 1; n < 3 * DMARX_LEN; n += 37) {
+        for (i = 0; i < n % DMARX_HALF; i++) // The most allowed between reads
+            SimDma_Request(CH, 0xFF);
+        DMARx_Flush(&rx);
+        CHECK(!DMARx_Read(&rx, &c));
+        for (i = 0; i < 3; i++)
+            SimDma_Request(CH, 'a' + i);
+        for (i = 0; i < 3; i++)
+            CHECK(DMARx_Read(&rx, &c) && c == 'a' + i);
+        CHECK(!DMARx_Read(&rx, &c));
+    }
+    CHECK(rx.numLaps == 0);
+}
+
+int main(int argc, char **argv) {
+    Corpus corpus;
+    
+    if (argc < 2) {
+        fprintf(stderr, "usage: test_dmarx corpus.nmea...\n");
+        return 2;
+    }
+    loadCorpus(&corpus, argc - 1, argv + 1);
+    srand(1);
+    testNMEA(&corpus);
+    testLink();
+    testFlush();
+    freeCorpus(&corpus);
+    printf("test_dmarx: %d checks passed\n", numChecks);
+    return 0;
+}
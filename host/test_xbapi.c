@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include "hostutil.h"
+#include "xbee.h"
+
+/*
+    Runs the API mode side of xbee.c against an emulated XBee. The
+    radio parses the API frames the firmware writes to the UART,
+    answers transmit requests with a transmit status and AT commands
+    with an AT command response, and hands the firmware received
+    packets, all as API frames that go back in through XB_RxByte and
+    XB_RxService. Built once for each API mode, so escaping is
+    covered too; the remote radio's address is made of bytes that need
+    escaping.
+*/
+
+volatile uint32 msTicks;
+
+static Self me;
+
+// The remote user and its radio
+#define THEM_ID 0x12345678UL
+static const uint8 themAddr[8] = {0x00, 0x13, 0xA2, 0x00, 0x7E, 0x7D, 0x11, 0x13};
+static const uint8 broadcast[8] = {0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+
+/*
+    The emulated radio. It parses what it is sent itself, as its frames
+    can be longer than the firmware ever receives. Transmit requests
+    are kept for the test to look at, and the replies it owes queue up
+    in <reply> until the test lets them through, as they'd come back
+    some time after the request.
+*/
+#define RADIO_REQUESTS 16
+
+typedef struct RadioFrame {
+    uint16 len;
+    uint8  data[XBAPI_TX_HEADER + XBAPI_MAX_RF];
+} RadioFrame;
+
+static struct {
+    uint8      raw[3 + sizeof(RadioFrame) + 1]; // Frame being received, unescaped
+    uint16     rawLen;
+    uint8      escaped;
+    RadioFrame req[RADIO_REQUESTS]; // Transmit requests and AT commands
+    int        numReq;
+    uint8      deliveryStatus; // Sent back for each transmit request
+    uint8      rssi; // Answer to DB
+    uint8      apMode; // AP, answered and set over API frames
+    char       text[32]; // Written outside API frames, for command mode
+    uint16     textLen;
+    uint8      reply[1024];
+    uint16     replyLen;
+} radio;
+
+static void radioReply(const uint8 *data, uint16 len) {
+    radio.replyLen += XBAPI_Encode(radio.reply + radio.replyLen, data, len);
+}
+
+// Acts on a whole frame from the firmware
+static void radioHandle(RadioFrame *a) {
+    CHECK(radio.numReq < RADIO_REQUESTS);
+    radio.req[radio.numReq++] = *a;
+    if (a->data[0] == XBAPI_TX_REQUEST && a->data[1]) {
+        uint8 status[7] = {XBAPI_TX_STATUS, a->data[1], 0xFF, 0xFE, 0,
+                           radio.deliveryStatus, 0};
+        radioReply(status, sizeof(status));
+    }
+    else if (a->data[0] == XBAPI_AT_COMMAND) {
+        int isAp = a->data[2] == 'A' && a->data[3] == 'P';
+        uint8 resp[6] = {XBAPI_AT_RESPONSE, a->data[1], a->data[2], a->data[3],
+                         0, isAp ? radio.apMode : radio.rssi};
+
+        if (isAp && a->len == 5)
+            radio.apMode = a->data[4];
+        else if (a->data[1])
+            radioReply(resp, a->len == 4 ? 6 : 5);
+    }
+}
+
+// Bytes the firmware writes to the XBee UART
+static void radioTx(const uint8 *data, uint16 len) {
+    RadioFrame a;
+    uint16 i, n;
+    uint8 c, sum;
+
+    while (len--) {
+        c = *data++;
+        if (!radio.rawLen) {
+            // Anything between frames is for command mode
+            if (c == XBAPI_START)
+                radio.rawLen = 1;
+            else {
+                CHECK(radio.textLen < sizeof(radio.text) - 1);
+                radio.text[radio.textLen++] = c;
+            }
+            continue;
+        }
+#if XB_API_MODE == 2
+        CHECK(c != XBAPI_START && c != 0x11 && c != 0x13);
+        if (c == XBAPI_ESCAPE) {
+            radio.escaped = 1;
+            continue;
+        }
+        if (radio.escaped)
+            c ^= 0x20;
+        radio.escaped = 0;
+#endif
+        radio.raw[radio.rawLen++] = c;
+        if (radio.rawLen < 3)
+            continue;
+        n = radio.raw[1] << 8 | radio.raw[2];
+        CHECK(n && n <= sizeof(a.data)); // The radio's NP limit
+        if (radio.rawLen < 3 + n + 1)
+            continue;
+        for (i = 3, sum = 0; i < radio.rawLen; i++)
+            sum += radio.raw[i];
+        CHECK(sum == 0xFF);
+        a.len = n;
+        memcpy(a.data, radio.raw + 3, n);
+        radio.rawLen = 0;
+        radioHandle(&a);
+    }
+}
+
+static int numLinkFrames;
+
+// A byte from the radio, and a pass of the main loop
+static void rxByte(uint8 c) {
+    XB_RxByte(c);
+    if (Ring_Peek(&xbRing))
+        ++numLinkFrames;
+    XB_RxService(&me);
+}
+
+// Lets the replies so far through to the firmware. Any it causes wait.
+static void radioDeliver() {
+    uint8 reply[sizeof(radio.reply)];
+    uint16 len = radio.replyLen, i;
+
+    memcpy(reply, radio.reply, len);
+    radio.replyLen = 0;
+    for (i = 0; i < len; i++)
+        rxByte(reply[i]);
+}
+
+// The radio receives a link frame over the air from <src>
+static void radioReceive(const uint8 *src, uint8 type, const void *payload, uint16 len) {
+    uint8 data[XBAPI_MAX_DATA] = {XBAPI_RX_PACKET};
+
+    memcpy(data + 1, src, 8);
+    data[9] = 0xFF;
+    data[10] = 0xFE;
+    data[11] = 0x01; // Acknowledged
+    len = XBL_Encode(data + XBAPI_RX_HEADER, type, payload, len);
+    CHECK(len <= XBAPI_MAX_RF);
+    radioReply(data, XBAPI_RX_HEADER + len);
+    radioDeliver();
+}
+
+// Runs the TX interrupt's pump until the queue is empty
+static void drain() {
+    int i;
+
+    for (i = 0; i < 1000 && (xbTx.cur || XB_TxDepth()); i++)
+        XB_TxPump();
+    CHECK(!xbTx.cur && !XB_TxDepth());
+}
+
+// Startup puts the radio in API mode, and checks it with an AP query
+static void testConfigure() {
+    char cmd[] = "+++ATAP0,WR,CN\r";
+
+    cmd[7] = '0' + XB_API_MODE;
+    radio.apMode = XB_API_MODE;
+    XB_ConfigureApi();
+    CHECK(!strcmp(radio.text, cmd));
+    drain();
+    CHECK(radio.numReq == 1);
+    CHECK(radio.req[0].len == 4);
+    CHECK(radio.req[0].data[0] == XBAPI_AT_COMMAND);
+    CHECK(radio.req[0].data[1] > XB_TX_IDS);
+    CHECK(!memcmp(radio.req[0].data + 2, "AP", 2));
+    CHECK(xbTx.apMode == XB_AP_UNKNOWN);
+    radioDeliver();
+    CHECK(xbTx.apMode == XB_API_MODE);
+    drain();
+    CHECK(radio.numReq == 1);
+
+    // A radio in the other API mode is set, saved and asked again
+    radio.apMode = 3 - XB_API_MODE;
+    radio.numReq = 0;
+    XB_ConfigureApi();
+    drain();
+    radioDeliver();
+    CHECK(xbTx.apMode == 3 - XB_API_MODE);
+    drain();
+    CHECK(radio.numReq == 4);
+    CHECK(radio.req[1].len == 5);
+    CHECK(!memcmp(radio.req[1].data + 2, "AP", 2));
+    CHECK(radio.req[1].data[4] == XB_API_MODE);
+    CHECK(!memcmp(radio.req[2].data + 2, "WR", 2));
+    CHECK(!memcmp(radio.req[3].data + 2, "AP", 2));
+    CHECK(radio.apMode == XB_API_MODE);
+    radioDeliver();
+    CHECK(xbTx.apMode == XB_API_MODE);
+    radio.numReq = 0;
+}
+
+static void testAnnounce() {
+    struct {
+        XBEE_Relay r;
+        XBEE_Announce a;
+    } ann = {{SHORT_ID(THEM_ID), 1, XB_RELAY_HOPS}};
+    User *u;
+
+    ann.a.beacon.shortID = SHORT_ID(THEM_ID);
+    ann.a.beacon.lat = XB_NO_FIX;
+    ann.a.beacon.slot = XB_NUM_SLOTS;
+    ann.a.uniqueID = THEM_ID;
+    strcpy(ann.a.name, "Beth");
+    radio.rssi = 0x2A;
+    radioReceive(themAddr, ANNOUNCE, &ann, sizeof(ann));
+    CHECK(numLinkFrames == 1);
+    CHECK(u = findUser(&me.users, THEM_ID, 0));
+    CHECK(!strcmp(u->name, "Beth"));
+    CHECK(!memcmp(u->addr, themAddr, 8));
+
+    // Heard directly, so the firmware asks for the signal strength
+    drain();
+    CHECK(radio.numReq == 1);
+    CHECK(radio.req[0].len == 4);
+    CHECK(radio.req[0].data[0] == XBAPI_AT_COMMAND);
+    CHECK(radio.req[0].data[1] > XB_TX_IDS);
+    CHECK(!memcmp(radio.req[0].data + 2, "DB", 2));
+    CHECK(u->rssi == 0);
+    radioDeliver();
+    CHECK(u->rssi == 0x2A);
+
+    // The same frame relayed back is ignored
+    radioReceive(broadcast, ANNOUNCE, &ann, sizeof(ann));
+    CHECK(numLinkFrames == 2);
+    drain();
+    CHECK(radio.numReq == 1);
+}
+
+/*
+    Sends a <len> character message to the remote user with the radio
+    reporting <status> for each fragment, and checks what went out.
+*/
+static void testMessage(int len, uint8 status) {
+    static XBL_Frame buf;
+    XBL_Framer fr = {&buf, XB_PAYLOAD_MAX, XB_NUM_TYPES};
+    User *u = findUser(&me.users, THEM_ID, 0);
+    char text[MSG_MAX_LEN + 1], got[MSG_MAX_LEN + 1];
+    int count = (len + XB_FRAG_DATA - 1) / XB_FRAG_DATA, gotLen = 0, i, j;
+    uint16 delivered = u->numDelivered, failed = u->numFailed;
+    RadioFrame *a;
+    XBL_Frame *f;
+
+    for (i = 0; i < len; i++)
+        text[i] = i % 5 ? 'a' + i % 26 : 0x7E; // Needs escaping too
+    text[len] = '\0';
+    memcpy(me.draft.msg, text, len + 1);
+    me.draft.msgLen = len;
+    radio.numReq = 0;
+    radio.deliveryStatus = status;
+    CHECK(sendMessage(&me, u));
+    drain();
+
+    // Unicast to the user's radio, one request per fragment, each
+    // asking for a status under its own frame ID
+    CHECK(radio.numReq == count);
+    for (i = 0; i < count; i++) {
+        a = &radio.req[i];
+        CHECK(a->data[0] == XBAPI_TX_REQUEST);
+        CHECK(a->data[1] != 0);
+        for (j = 0; j < i; j++)
+            CHECK(radio.req[j].data[1] != a->data[1]);
+        CHECK(!memcmp(a->data + 2, themAddr, 8));
+        CHECK(a->len - XBAPI_TX_HEADER <= XBAPI_MAX_RF);
+        for (j = XBAPI_TX_HEADER; j < a->len; j++) {
+            if (!(f = XBL_Feed(&fr, a->data[j])))
+                continue;
+            XBEE_Header *hdr = (XBEE_Header*)(f->data + sizeof(XBEE_Relay));
+
+            CHECK(f->type == MESSAGE);
+            CHECK(hdr->destID == THEM_ID);
+            CHECK(hdr->srcID == me.id);
+            CHECK(hdr->frag == (i << 4 | (count - 1)));
+            memcpy(got + gotLen, hdr + 1, f->len - sizeof(XBEE_Relay) - sizeof(XBEE_Header));
+            gotLen += f->len - sizeof(XBEE_Relay) - sizeof(XBEE_Header);
+        }
+    }
+    CHECK(gotLen == len);
+    CHECK(!memcmp(got, text, len));
+
+    CHECK(u->numDelivered == delivered && u->numFailed == failed);
+    radioDeliver();
+    if (status == 0)
+        CHECK(u->numDelivered == delivered + count && u->numFailed == failed);
+    else
+        CHECK(u->numFailed == failed + count && u->numDelivered == delivered);
+}
+
+// Beacons are broadcast and don't ask for a status
+static void testBeacon() {
+    radio.numReq = 0;
+    broadcastPosition(&me);
+    drain();
+    CHECK(radio.numReq == 1);
+    CHECK(radio.req[0].data[0] == XBAPI_TX_REQUEST);
+    CHECK(radio.req[0].data[1] == 0);
+    CHECK(!memcmp(radio.req[0].data + 2, broadcast, 8));
+    CHECK(radio.replyLen == 0);
+}
+
+// Replies the firmware has to ignore
+static void testBadReplies() {
+    User *u = findUser(&me.users, THEM_ID, 0);
+    uint16 delivered = u->numDelivered, bad = xbApiFramer.numBadChecksum;
+    uint8 status[7] = {XBAPI_TX_STATUS, xbTx.lastTxId, 0xFF, 0xFE, 0, 0, 0};
+    uint8 unknown[7] = {XBAPI_TX_STATUS, 0, 0xFF, 0xFE, 0, 0, 0};
+    uint8 atId[7] = {XBAPI_TX_STATUS, XB_TX_IDS + xbTx.lastAtId, 0xFF, 0xFE, 0, 0, 0};
+    uint8 failedDB[6] = {XBAPI_AT_RESPONSE, XB_TX_IDS + xbTx.lastAtId, 'D', 'B', 1, 0x60};
+    uint8 txIdDB[6] = {XBAPI_AT_RESPONSE, xbTx.lastTxId, 'D', 'B', 0, 0x60};
+    uint8 shortStatus[3] = {XBAPI_TX_STATUS, xbTx.lastTxId, 0xFF};
+
+    radioReply(status, sizeof(status));
+    radio.reply[radio.replyLen - 1] ^= 0x01; // Checksum
+    radioReply(unknown, sizeof(unknown));
+    radioReply(atId, sizeof(atId));
+    radioReply(failedDB, sizeof(failedDB));
+    radioReply(txIdDB, sizeof(txIdDB));
+    radioReply(shortStatus, sizeof(shortStatus));
+    radioDeliver();
+    CHECK(xbApiFramer.numBadChecksum == bad + 1);
+    CHECK(u->numDelivered == delivered);
+    CHECK(u->rssi == 0x2A);
+
+    // The framer still picks up the next good one
+    radioReply(status, sizeof(status));
+    radioDeliver();
+    CHECK(u->numDelivered == delivered + 1);
+}
+
+int main() {
+    Host_XbTx = radioTx;
+    strcpy(me.name, "Alfred");
+    CyGetUniqueId(&me.id);
+    msTicks = 1000;
+    XB_BeaconInit(&me);
+
+    testConfigure();
+    testAnnounce();
+    testMessage(200, 0);
+    testMessage(MSG_MAX_LEN, 0);
+    testMessage(7, 0x21); // Network ACK failure
+    testBeacon();
+    testBadReplies();
+    printf("test_xbapi (API mode %d): %d checks passed\n", XB_API_MODE, numChecks);
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hostutil.h"
+#include "xblink.h"
+
+/*
+    Runs XBL_Feed over corrupted link streams: false start bytes, bad
+    lengths, unknown types, bad CRCs and lost bytes. Each bad frame must
+    be counted, and every intact frame after it still received.
+
+    test_xblink
+*/
+
+#define MAX_LEN   94
+#define NUM_TYPES 4
+#define NUM_FRAMES 2000
+
+typedef struct Sent {
+    uint8  type;
+    uint16 len;
+    uint8  data[MAX_LEN];
+    int    intact; // Went out as encoded
+} Sent;
+
+static Sent sent[NUM_FRAMES];
+static uint8 stream[NUM_FRAMES * (XBL_OVERHEAD + MAX_LEN + 4)];
+static size_t streamLen;
+static XBL_Frame frame;
+static XBL_Framer fr;
+
+static void reset() {
+    memset(&fr, 0, sizeof(fr));
+    fr.f = &frame;
+    fr.maxLen = MAX_LEN;
+    fr.numTypes = NUM_TYPES;
+    streamLen = 0;
+}
+
+// Makes up frame <i>, with its number in the first two bytes and start
+// bytes scattered through the rest
+static Sent *makeFrame(int i, uint16 len) {
+    Sent *s = &sent[i];
+    uint16 j;
+
+    s->type = i % NUM_TYPES;
+    s->len = len;
+    for (j = 0; j < len; j++)
+        s->data[j] = rand() % 8 ? rand() : XBL_START;
+    s->data[0] = i & 0xFF;
+    s->data[1] = i >> 8;
+    s->intact = 1;
+    return s;
+}
+
+static void put(const uint8 *data, size_t len) {
+    memcpy(stream + streamLen, data, len);
+    streamLen += len;
+}
+
+static void putFrame(Sent *s) {
+    streamLen += XBL_Encode(stream + streamLen, s->type, s->data, s->len);
+}
+
+// Feeds the stream, then enough idle bytes to finish any frame in
+// progress, and checks that exactly the intact frames among the first
+// <n> came out, in order
+static void feedAndCheck(int n) {
+    static const uint8 idle[XBL_OVERHEAD + MAX_LEN];
+    int next = 0, got = 0;
+    size_t i;
+    XBL_Frame *f;
+
+    put(idle, sizeof(idle));
+    for (i = 0; i < streamLen; i++) {
+        if (!(f = XBL_Feed(&fr, stream[i])))
+            continue;
+        while (next < n && !sent[next].intact)
+            ++next;
+        CHECK(next < n);
+        CHECK(f->type == sent[next].type);
+        CHECK(f->len == sent[next].len);
+        CHECK(!memcmp(f->data, sent[next].data, f->len));
+        ++next;
+        ++got;
+    }
+    while (next < n && !sent[next].intact)
+        ++next;
+    CHECK(next == n);
+    CHECK(got > 0);
+    CHECK(fr.numHeld == 0);
+}
+
+// One of each kind of damage, each followed by a good frame. The start
+// bytes in the payloads make for more bad frames in the rescans, so
+// the counts are only checked for the kind of damage done.
+static void testEach() {
+    uint8 bad[XBL_OVERHEAD + MAX_LEN];
+    uint16 len;
+
+    // A false start byte in the line noise just before a frame
+    reset();
+    put((const uint8 *)"\x12\xA5", 2);
+    putFrame(makeFrame(0, 20));
+    feedAndCheck(1);
+    CHECK(fr.numTooLong + fr.numBadType + fr.numBadCrc == 1);
+
+    // Longer than the link allows, though not than XBL_MAX_LEN
+    reset();
+    makeFrame(0, MAX_LEN);
+    len = XBL_Encode(bad, 0, sent[0].data, MAX_LEN);
+    bad[1] = MAX_LEN + 1;
+    put(bad, len);
+    sent[0].intact = 0;
+    putFrame(makeFrame(1, 30));
+    feedAndCheck(2);
+    CHECK(fr.numTooLong >= 1);
+
+    // A type nobody knows
+    reset();
+    put(bad, XBL_Encode(bad, NUM_TYPES, sent[1].data, 10));
+    putFrame(makeFrame(0, 10));
+    feedAndCheck(1);
+    CHECK(fr.numBadType >= 1);
+
+    // A flipped bit in the payload
+    reset();
+    len = XBL_Encode(bad, 1, makeFrame(0, 40)->data, 40);
+    bad[10] ^= 0x08;
+    put(bad, len);
+    sent[0].intact = 0;
+    putFrame(makeFrame(1, 40));
+    feedAndCheck(2);
+    CHECK(fr.numBadCrc >= 1);
+
+    // Bytes lost out of a long frame, so that what it still expects
+    // covers the next three frames. They all come out of the rescan
+    // after its CRC fails, one call apart.
+    reset();
+    len = XBL_Encode(bad, 2, makeFrame(0, MAX_LEN)->data, MAX_LEN);
+    put(bad, 4 + 10);
+    sent[0].intact = 0;
+    putFrame(makeFrame(1, 5));
+    putFrame(makeFrame(2, 0));
+    putFrame(makeFrame(3, 50));
+    feedAndCheck(4);
+    CHECK(fr.numBadCrc + fr.numBadType + fr.numTooLong >= 1);
+}
+
+// Lots of frames with random damage to some of them
+static void testRandom() {
+    uint8 bad[XBL_OVERHEAD + MAX_LEN];
+    int i, j, last;
+    uint16 len;
+
+    reset();
+    for (i = 0; i < NUM_FRAMES; i++) {
+        makeFrame(i, rand() % (MAX_LEN + 1));
+        last = i == NUM_FRAMES - 1;
+        if (rand() % 4 || last) {
+            putFrame(&sent[i]);
+            if (!(rand() % 8) && !last) // Line noise between frames
+                put((const uint8 *)"\xA5", 1);
+            continue;
+        }
+        sent[i].intact = 0;
+        len = XBL_Encode(bad, sent[i].type, sent[i].data, sent[i].len);
+        switch (rand() % 3) {
+            case 0: // Flipped bits
+                for (j = rand() % 3; j >= 0; j--)
+                    bad[1 + rand() % (len - 1)] ^= 1 << rand() % 8;
+                put(bad, len);
+                break;
+            case 1: // Lost bytes
+                j = 1 + rand() % (len - 1);
+                put(bad, j);
+                j += 1 + rand() % 4;
+                if (j < len)
+                    put(bad + j, len - j);
+                break;
+            default: // Cut short
+                put(bad, rand() % len);
+                break;
+        }
+    }
+    feedAndCheck(NUM_FRAMES);
+    CHECK(fr.numBadCrc > 0);
+    CHECK(fr.numTooLong > 0);
+    CHECK(fr.numBadType > 0);
+    printf("random: %d frames, %u bad CRC, %u too long, %u bad type\n", NUM_FRAMES,
+           fr.numBadCrc, fr.numTooLong, fr.numBadType);
+}
+
+int main() {
+    srand(1);
+    testEach();
+    testRandom();
+    printf("test_xblink: %d checks passed\n", numChecks);
+    return 0;
+}